@@ -0,0 +1,143 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <utility>
+
+#include "batch_writer.hpp"
+#include "timer.hpp"
+
+namespace hibp
+{
+    namespace
+    {
+        inline std::uint64_t nanoseconds(util::timer const &t)
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.elapsed()).count());
+        }
+    }
+
+    template <std::size_t DigestSize>
+    basic_batch_writer<DigestSize>::basic_batch_writer(std::filesystem::path const &output_filename,
+                                                       std::filesystem::path const &checkpoint_filename,
+                                                       bool direct_io,
+                                                       std::size_t capacity)
+        : output_filename_(output_filename),
+          checkpoint_filename_(checkpoint_filename),
+          out_(output_filename, direct_io),
+          capacity_(std::max<std::size_t>(1, capacity))
+    {
+        thread_ = std::thread(&basic_batch_writer::run, this);
+    }
+
+    template <std::size_t DigestSize>
+    basic_batch_writer<DigestSize>::~basic_batch_writer()
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+            // whoever cares about write errors calls `close()` themselves
+        }
+    }
+
+    template <std::size_t DigestSize>
+    void basic_batch_writer<DigestSize>::push(collection_type &&hashes, std::size_t first_prefix, std::size_t next_prefix)
+    {
+        util::timer t;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]
+                 { return queue_.size() < capacity_ || error_; });
+        stall_ns_ += nanoseconds(t);
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        queue_.push_back(job{std::move(hashes), first_prefix, next_prefix});
+        cv_.notify_all();
+    }
+
+    template <std::size_t DigestSize>
+    void basic_batch_writer<DigestSize>::close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closing_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+        if (error_)
+        {
+            std::exception_ptr error = std::exchange(error_, nullptr);
+            std::rethrow_exception(error);
+        }
+    }
+
+    template <std::size_t DigestSize>
+    void basic_batch_writer<DigestSize>::run()
+    {
+        for (;;)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]
+                     { return !queue_.empty() || closing_; });
+            if (queue_.empty())
+            {
+                return;
+            }
+            // keep the job queued while it's written, so that it counts
+            // against the capacity
+            job const &j = queue_.front();
+            lock.unlock();
+            try
+            {
+                write(j);
+            }
+            catch (...)
+            {
+                lock.lock();
+                error_ = std::current_exception();
+                queue_.clear();
+                cv_.notify_all();
+                return;
+            }
+            lock.lock();
+            queue_.pop_front();
+            cv_.notify_all();
+        }
+    }
+
+    template <std::size_t DigestSize>
+    void basic_batch_writer<DigestSize>::write(job const &j)
+    {
+        util::timer t;
+        // the checkpoint mustn't claim records that aren't on disk
+        out_.write(j.hashes);
+        bytes_written_ = out_.bytes_written();
+        std::ofstream checkpoint(checkpoint_filename_, std::ios::trunc);
+        checkpoint
+            << std::hex
+            << std::setw(4) << std::setfill('0')
+            << j.first_prefix
+            << '-'
+            << std::setw(4) << std::setfill('0')
+            << j.next_prefix
+            << '\n'
+            << output_filename_.generic_string();
+        checkpoint.close();
+        write_ns_ += nanoseconds(t);
+    }
+
+    template class basic_batch_writer<Sha1Size>;
+    template class basic_batch_writer<NtlmSize>;
+}
@@ -0,0 +1,127 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __BATCH_WRITER_HPP__
+#define __BATCH_WRITER_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "block_writer.hpp"
+#include "hash_count.hpp"
+
+namespace hibp
+{
+    /**
+     * Writes finished batches to the output file on a thread of its own,
+     * each followed by the checkpoint that marks it as done, so that the
+     * caller can go on collecting the next batch meanwhile.
+     *
+     * Batches are handed over through a queue of at most `capacity`
+     * entries; `push()` blocks while it's full, which in turn holds back
+     * the downloader once it has run `MaxBatchesAhead` batches ahead.
+     */
+    template <std::size_t DigestSize>
+    class basic_batch_writer final
+    {
+    public:
+        typedef basic_collection<DigestSize> collection_type;
+
+        static constexpr std::size_t DefaultCapacity = 2;
+
+        /**
+         * With `direct_io`, bypass the page cache if possible, see
+         * `basic_block_writer`.
+         * @throws std::runtime_error if `output_filename` cannot be opened
+         */
+        basic_batch_writer(std::filesystem::path const &output_filename,
+                           std::filesystem::path const &checkpoint_filename,
+                           bool direct_io = false,
+                           std::size_t capacity = DefaultCapacity);
+        basic_batch_writer(basic_batch_writer const &) = delete;
+        basic_batch_writer &operator=(basic_batch_writer const &) = delete;
+        ~basic_batch_writer();
+
+        /**
+         * Queue the records of the prefixes [`first_prefix`, `next_prefix`)
+         * for writing.
+         * @throws whatever made an earlier write fail
+         */
+        void push(collection_type &&hashes, std::size_t first_prefix, std::size_t next_prefix);
+
+        /**
+         * Write what's left in the queue and stop the thread.
+         * @throws whatever made a write fail
+         */
+        void close();
+
+        /** bytes written to the output file so far */
+        inline std::uint64_t bytes_written() const
+        {
+            return bytes_written_.load();
+        }
+
+        /** time spent writing, checkpoints included */
+        inline std::uint64_t write_ns() const
+        {
+            return write_ns_.load();
+        }
+
+        /** whether the page cache is bypassed */
+        inline bool direct() const
+        {
+            return out_.direct();
+        }
+
+        /** why direct I/O was asked for, but isn't used */
+        inline std::string const &direct_io_unavailable_reason() const
+        {
+            return out_.direct_io_unavailable_reason();
+        }
+
+        /** time `push()` had to wait for room in the queue */
+        inline std::uint64_t stall_ns() const
+        {
+            return stall_ns_.load();
+        }
+
+    private:
+        struct job
+        {
+            collection_type hashes;
+            std::size_t first_prefix;
+            std::size_t next_prefix;
+        };
+        std::filesystem::path output_filename_;
+        std::filesystem::path checkpoint_filename_;
+        basic_block_writer<DigestSize> out_;
+        std::size_t capacity_;
+        std::deque<job> queue_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool closing_{false};
+        std::exception_ptr error_;
+        std::atomic<std::uint64_t> bytes_written_{0};
+        std::atomic<std::uint64_t> write_ns_{0};
+        std::atomic<std::uint64_t> stall_ns_{0};
+        std::thread thread_;
+
+        void run();
+        void write(job const &j);
+    };
+
+    typedef basic_batch_writer<Sha1Size> batch_writer;
+    typedef basic_batch_writer<NtlmSize> ntlm_batch_writer;
+}
+
+#endif // __BATCH_WRITER_HPP__
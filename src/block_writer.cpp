@@ -0,0 +1,137 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "block_writer.hpp"
+#include "simd.hpp"
+
+namespace hibp
+{
+    template <std::size_t DigestSize>
+    basic_block_writer<DigestSize>::basic_block_writer(std::filesystem::path const &filename, bool direct_io, std::size_t buffer_size)
+        : filename_(filename),
+          capacity_(std::max<std::size_t>(1, buffer_size / RecordSize))
+    {
+        buf_.reset(static_cast<std::uint8_t *>(::operator new(capacity_ * RecordSize, std::align_val_t{BufferAlignment})));
+        if (direct_io)
+        {
+            direct_ = direct_writer::open(filename, direct_io_unavailable_reason_);
+            if (direct_)
+            {
+                return;
+            }
+        }
+#if defined(__unix__) || defined(__APPLE__)
+        fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+        {
+            throw std::runtime_error("cannot open " + filename.string() + " for writing: " + std::strerror(errno));
+        }
+#else
+        out_.open(filename, std::ios::binary | std::ios::app);
+        if (!out_)
+        {
+            throw std::runtime_error("cannot open " + filename.string() + " for writing");
+        }
+#endif
+    }
+
+    template <std::size_t DigestSize>
+    basic_block_writer<DigestSize>::~basic_block_writer()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    template <std::size_t DigestSize>
+    void basic_block_writer<DigestSize>::aligned_delete::operator()(std::uint8_t *p) const
+    {
+        ::operator delete(p, std::align_val_t{BufferAlignment});
+    }
+
+    template <std::size_t DigestSize>
+    void basic_block_writer<DigestSize>::encode(record_type const *first, std::size_t n, std::uint8_t *dst)
+    {
+        // a record in memory is the record on disk, but with the count in
+        // host byte order
+        static_assert(sizeof(record_type) == RecordSize);
+        static_assert(offsetof(record_type, count) == DigestSize);
+        simd::active().encode_records(reinterpret_cast<std::uint8_t const *>(first), dst, n, RecordSize);
+    }
+
+    template <std::size_t DigestSize>
+    void basic_block_writer<DigestSize>::write(record_type const *first, std::size_t n)
+    {
+        while (n > 0)
+        {
+            std::size_t const chunk = std::min(n, capacity_);
+            encode(first, chunk, buf_.get());
+            if (direct_)
+            {
+                direct_->write(buf_.get(), chunk * RecordSize);
+                bytes_written_ += chunk * RecordSize;
+            }
+            else
+            {
+                write_fully(buf_.get(), chunk * RecordSize);
+            }
+            first += chunk;
+            n -= chunk;
+        }
+        if (direct_)
+        {
+            direct_->flush();
+        }
+    }
+
+    template <std::size_t DigestSize>
+    void basic_block_writer<DigestSize>::write_fully(std::uint8_t const *data, std::size_t size)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        while (size > 0)
+        {
+            ssize_t const n = ::write(fd_, data, size);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("cannot write to " + filename_.string() + ": " + std::strerror(errno));
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+            bytes_written_ += static_cast<std::uint64_t>(n);
+        }
+#else
+        out_.write(reinterpret_cast<char const *>(data), static_cast<std::streamsize>(size));
+        out_.flush();
+        if (!out_)
+        {
+            throw std::runtime_error("cannot write to " + filename_.string());
+        }
+        bytes_written_ += size;
+#endif
+    }
+
+    template class basic_block_writer<Sha1Size>;
+    template class basic_block_writer<NtlmSize>;
+}
@@ -0,0 +1,115 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __BLOCK_WRITER_HPP__
+#define __BLOCK_WRITER_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#if !defined(__unix__) && !defined(__APPLE__)
+#include <fstream>
+#endif
+
+#include "direct_writer.hpp"
+#include "hash_count.hpp"
+
+namespace hibp
+{
+    /**
+     * Appends records to a file in the format of `basic_hash_count::dump()`,
+     * but in bulk: the records are encoded a buffer's worth at a time,
+     * with the counts byte-swapped by the active SIMD kernel, and each
+     * buffer goes to the OS in a single `write()`, or, on request, to a
+     * `direct_writer` that bypasses the page cache.
+     */
+    template <std::size_t DigestSize>
+    class basic_block_writer final
+    {
+    public:
+        typedef basic_hash_count<DigestSize> record_type;
+        typedef basic_collection<DigestSize> collection_type;
+
+        /** size of a record in the file */
+        static constexpr std::size_t RecordSize = DigestSize + sizeof(std::uint32_t);
+        static constexpr std::size_t DefaultBufferSize = std::size_t{8} << 20;
+        /** alignment of the buffer, a page on common systems */
+        static constexpr std::size_t BufferAlignment = 4096;
+
+        /**
+         * Open `filename` for appending, creating it if need be. With
+         * `direct_io`, write with `direct_writer` if possible.
+         * @throws std::runtime_error if it can't be opened
+         */
+        explicit basic_block_writer(std::filesystem::path const &filename, bool direct_io = false, std::size_t buffer_size = DefaultBufferSize);
+        basic_block_writer(basic_block_writer const &) = delete;
+        basic_block_writer &operator=(basic_block_writer const &) = delete;
+        ~basic_block_writer();
+
+        /**
+         * Append the `n` records at `first`; they're in the file, or at
+         * least in the page cache, when this returns.
+         * @throws std::runtime_error if the file can't be written
+         */
+        void write(record_type const *first, std::size_t n);
+
+        inline void write(collection_type const &hashes)
+        {
+            write(hashes.data(), hashes.size());
+        }
+
+        /**
+         * Encode the `n` records at `first` into the `n` * `RecordSize`
+         * bytes at `dst`, exactly as `basic_hash_count::dump()` would.
+         */
+        static void encode(record_type const *first, std::size_t n, std::uint8_t *dst);
+
+        inline std::uint64_t bytes_written() const
+        {
+            return bytes_written_;
+        }
+
+        /** whether the page cache is bypassed */
+        inline bool direct() const
+        {
+            return direct_ != nullptr;
+        }
+
+        /** why direct I/O was asked for, but isn't used */
+        inline std::string const &direct_io_unavailable_reason() const
+        {
+            return direct_io_unavailable_reason_;
+        }
+
+    private:
+        struct aligned_delete
+        {
+            void operator()(std::uint8_t *p) const;
+        };
+
+        std::filesystem::path filename_;
+        std::unique_ptr<std::uint8_t[], aligned_delete> buf_;
+        /** records that fit into `buf_` */
+        std::size_t capacity_;
+        std::uint64_t bytes_written_{0};
+        std::unique_ptr<direct_writer> direct_;
+        std::string direct_io_unavailable_reason_;
+#if defined(__unix__) || defined(__APPLE__)
+        int fd_{-1};
+#else
+        std::ofstream out_;
+#endif
+
+        void write_fully(std::uint8_t const *data, std::size_t size);
+    };
+
+    typedef basic_block_writer<Sha1Size> block_writer;
+    typedef basic_block_writer<NtlmSize> ntlm_block_writer;
+}
+
+#endif // __BLOCK_WRITER_HPP__
@@ -0,0 +1,314 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "block_writer.hpp"
+#include "compact_format.hpp"
+#include "mapped_records.hpp"
+#include "timer.hpp"
+
+namespace fs = std::filesystem;
+
+namespace hibp
+{
+    namespace
+    {
+        constexpr std::array<char, 8> Magic{'H', 'I', 'B', 'P', 'C', 'M', 'P', '1'};
+        /** records handed over between readers and writers at a time */
+        constexpr std::size_t ChunkSize = std::size_t{1} << 16;
+
+        inline void store_be(std::uint8_t *p, std::uint64_t v, std::size_t bytes)
+        {
+            for (std::size_t i = bytes; i > 0; --i)
+            {
+                p[i - 1] = static_cast<std::uint8_t>(v);
+                v >>= 8;
+            }
+        }
+
+        inline std::uint64_t load_be(std::uint8_t const *p, std::size_t bytes)
+        {
+            std::uint64_t v = 0;
+            for (std::size_t i = 0; i < bytes; ++i)
+            {
+                v = v << 8 | p[i];
+            }
+            return v;
+        }
+
+        /** bytes the count takes after the digest */
+        inline std::size_t count_bytes(std::uint32_t count)
+        {
+            return count <= compact::MaxInlineCount ? 0
+                   : count < (1U << 8)              ? 1
+                   : count < (1U << 16)             ? 2
+                   : count < (1U << 24)             ? 3
+                                                    : 4;
+        }
+
+        inline std::uint64_t nanoseconds(util::timer const &t)
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.elapsed()).count());
+        }
+
+        void check_distinct(fs::path const &input, fs::path const &output)
+        {
+            if (fs::exists(output) && fs::equivalent(input, output))
+            {
+                throw std::runtime_error("output file " + output.string() + " is also the input");
+            }
+        }
+    }
+
+    std::size_t compact::digest_size(fs::path const &filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        std::array<char, HeaderSize> header{};
+        if (!in.read(header.data(), header.size()) || !std::equal(Magic.begin(), Magic.end(), header.begin()))
+        {
+            return 0;
+        }
+        return static_cast<std::size_t>(load_be(reinterpret_cast<std::uint8_t const *>(header.data()) + Magic.size(), 4));
+    }
+
+    template <std::size_t DigestSize>
+    basic_compact_writer<DigestSize>::basic_compact_writer(fs::path const &filename)
+        : filename_(filename),
+          out_(filename, std::ios::binary | std::ios::trunc),
+          offsets_(compact::BucketCount + 1, 0),
+          buf_(BufferSize)
+    {
+        if (!out_)
+        {
+            throw std::runtime_error("cannot open " + filename.string() + " for writing");
+        }
+        // room for the header and the table, which are known only at the end
+        std::vector<char> const zeros(compact::DataOffset, 0);
+        out_.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+    }
+
+    template <std::size_t DigestSize>
+    void basic_compact_writer<DigestSize>::write(record_type const *first, std::size_t n)
+    {
+        // head byte, digest without the bucket, and the longest count
+        constexpr std::size_t MaxRecordSize = 1 + (DigestSize - 3) + sizeof(std::uint32_t);
+        for (record_type const *h = first; h != first + n; ++h)
+        {
+            if (records_ > 0 && std::memcmp(previous_.data(), h->data.data(), DigestSize) > 0)
+            {
+                throw std::runtime_error("records aren't sorted; `merge` sorts them");
+            }
+            previous_ = h->data;
+            std::size_t const bucket = static_cast<std::size_t>(h->data[0]) << 12 | static_cast<std::size_t>(h->data[1]) << 4 | static_cast<std::size_t>(h->data[2]) >> 4;
+            while (next_bucket_ <= bucket)
+            {
+                offsets_[next_bucket_++] = data_size_;
+            }
+            if (fill_ + MaxRecordSize > buf_.size())
+            {
+                flush();
+            }
+            std::uint8_t *p = buf_.data() + fill_;
+            std::size_t const extra = count_bytes(h->count);
+            unsigned const tag = extra == 0 ? h->count : compact::MaxInlineCount + static_cast<unsigned>(extra);
+            *p++ = static_cast<std::uint8_t>((h->data[2] & 0x0f) << 4 | tag);
+            std::memcpy(p, h->data.data() + 3, DigestSize - 3);
+            p += DigestSize - 3;
+            store_be(p, h->count, extra);
+            p += extra;
+            std::size_t const size = static_cast<std::size_t>(p - (buf_.data() + fill_));
+            fill_ += size;
+            data_size_ += size;
+            ++records_;
+        }
+    }
+
+    template <std::size_t DigestSize>
+    void basic_compact_writer<DigestSize>::flush()
+    {
+        out_.write(reinterpret_cast<char const *>(buf_.data()), static_cast<std::streamsize>(fill_));
+        if (!out_)
+        {
+            throw std::runtime_error("cannot write to " + filename_.string());
+        }
+        fill_ = 0;
+    }
+
+    template <std::size_t DigestSize>
+    void basic_compact_writer<DigestSize>::close()
+    {
+        flush();
+        while (next_bucket_ <= compact::BucketCount)
+        {
+            offsets_[next_bucket_++] = data_size_;
+        }
+        std::vector<std::uint8_t> head(compact::DataOffset);
+        std::copy(Magic.begin(), Magic.end(), head.begin());
+        store_be(head.data() + Magic.size(), DigestSize, 4);
+        store_be(head.data() + Magic.size() + 8, records_, 8);
+        for (std::size_t b = 0; b <= compact::BucketCount; ++b)
+        {
+            store_be(head.data() + compact::HeaderSize + b * sizeof(std::uint64_t), offsets_[b], sizeof(std::uint64_t));
+        }
+        out_.seekp(0);
+        out_.write(reinterpret_cast<char const *>(head.data()), static_cast<std::streamsize>(head.size()));
+        out_.close();
+        if (!out_)
+        {
+            throw std::runtime_error("cannot write to " + filename_.string());
+        }
+    }
+
+    template <std::size_t DigestSize>
+    basic_compact_reader<DigestSize>::basic_compact_reader(fs::path const &filename, access_pattern pattern)
+        : filename_(filename),
+          file_(filename, pattern)
+    {
+        std::uint8_t const *const p = file_.data();
+        if (file_.size() < compact::DataOffset || !std::equal(Magic.begin(), Magic.end(), p))
+        {
+            throw std::runtime_error(filename.string() + " isn't in the compact format");
+        }
+        std::size_t const digest_size = static_cast<std::size_t>(load_be(p + Magic.size(), 4));
+        if (digest_size != DigestSize)
+        {
+            throw std::runtime_error(filename.string() + " holds " + std::to_string(digest_size) + "-byte digests, not " + std::to_string(DigestSize) + "-byte ones");
+        }
+        record_count_ = load_be(p + Magic.size() + 8, 8);
+        // so that `read()` can trust the offsets
+        bool consistent = offset(0) == 0 && offset(compact::BucketCount) == file_.size() - compact::DataOffset;
+        for (std::size_t b = 0; b < compact::BucketCount && consistent; ++b)
+        {
+            consistent = offset(b) <= offset(b + 1);
+        }
+        if (!consistent)
+        {
+            throw std::runtime_error("the bucket table of " + filename.string() + " is corrupt");
+        }
+    }
+
+    template <std::size_t DigestSize>
+    std::uint64_t basic_compact_reader<DigestSize>::offset(std::size_t bucket) const
+    {
+        return load_be(file_.data() + compact::HeaderSize + bucket * sizeof(std::uint64_t), sizeof(std::uint64_t));
+    }
+
+    template <std::size_t DigestSize>
+    std::size_t basic_compact_reader<DigestSize>::read(std::size_t bucket, basic_collection<DigestSize> &out) const
+    {
+        std::uint8_t const *p = file_.data() + compact::DataOffset + offset(bucket);
+        std::uint8_t const *const end = file_.data() + compact::DataOffset + offset(bucket + 1);
+        std::uint8_t const b0 = static_cast<std::uint8_t>(bucket >> 12);
+        std::uint8_t const b1 = static_cast<std::uint8_t>(bucket >> 4);
+        std::uint8_t const b2 = static_cast<std::uint8_t>(bucket << 4);
+        std::size_t const n = out.size();
+        while (p < end)
+        {
+            unsigned const tag = *p & 0x0f;
+            std::size_t const extra = tag > compact::MaxInlineCount ? tag - compact::MaxInlineCount : 0;
+            if (static_cast<std::size_t>(end - p) < 1 + (DigestSize - 3) + extra)
+            {
+                out.resize(n);
+                throw std::runtime_error("bucket " + std::to_string(bucket) + " of " + filename_.string() + " ends in a truncated record");
+            }
+            basic_hash_count<DigestSize> &h = out.emplace_back();
+            h.data[0] = b0;
+            h.data[1] = b1;
+            h.data[2] = static_cast<std::uint8_t>(b2 | *p >> 4);
+            std::memcpy(h.data.data() + 3, p + 1, DigestSize - 3);
+            p += 1 + (DigestSize - 3);
+            h.count = extra == 0 ? tag : static_cast<std::uint32_t>(load_be(p, extra));
+            p += extra;
+        }
+        return out.size() - n;
+    }
+
+    template <std::size_t DigestSize>
+    conversion_stats convert_to_compact(fs::path const &input, fs::path const &output)
+    {
+        util::timer t;
+        check_distinct(input, output);
+        basic_mapped_records<DigestSize> const records(input, access_pattern::sequential);
+        basic_compact_writer<DigestSize> out(output);
+        basic_collection<DigestSize> chunk;
+        chunk.reserve(ChunkSize);
+        try
+        {
+            for (basic_record_ref<DigestSize> const record : records)
+            {
+                chunk.push_back(record.to_hash_count());
+                if (chunk.size() == ChunkSize)
+                {
+                    out.write(chunk);
+                    chunk.clear();
+                }
+            }
+            out.write(chunk);
+            out.close();
+        }
+        catch (...)
+        {
+            fs::remove(output);
+            throw;
+        }
+        conversion_stats stats;
+        stats.records = out.records_written();
+        stats.input_bytes = records.size_bytes();
+        stats.output_bytes = out.bytes_written();
+        stats.elapsed_ns = nanoseconds(t);
+        return stats;
+    }
+
+    template <std::size_t DigestSize>
+    conversion_stats convert_from_compact(fs::path const &input, fs::path const &output)
+    {
+        util::timer t;
+        check_distinct(input, output);
+        basic_compact_reader<DigestSize> const in(input, access_pattern::sequential);
+        // the block writer appends
+        fs::remove(output);
+        basic_block_writer<DigestSize> out(output);
+        basic_collection<DigestSize> chunk;
+        chunk.reserve(ChunkSize);
+        conversion_stats stats;
+        try
+        {
+            for (std::size_t bucket = 0; bucket < compact::BucketCount; ++bucket)
+            {
+                stats.records += in.read(bucket, chunk);
+                if (chunk.size() >= ChunkSize)
+                {
+                    out.write(chunk);
+                    chunk.clear();
+                }
+            }
+            out.write(chunk);
+        }
+        catch (...)
+        {
+            fs::remove(output);
+            throw;
+        }
+        stats.input_bytes = in.size_bytes();
+        stats.output_bytes = out.bytes_written();
+        stats.elapsed_ns = nanoseconds(t);
+        return stats;
+    }
+
+    template class basic_compact_writer<Sha1Size>;
+    template class basic_compact_writer<NtlmSize>;
+    template class basic_compact_reader<Sha1Size>;
+    template class basic_compact_reader<NtlmSize>;
+    template conversion_stats convert_to_compact<Sha1Size>(fs::path const &, fs::path const &);
+    template conversion_stats convert_to_compact<NtlmSize>(fs::path const &, fs::path const &);
+    template conversion_stats convert_from_compact<Sha1Size>(fs::path const &, fs::path const &);
+    template conversion_stats convert_from_compact<NtlmSize>(fs::path const &, fs::path const &);
+}
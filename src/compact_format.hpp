@@ -0,0 +1,202 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __COMPACT_FORMAT_HPP__
+#define __COMPACT_FORMAT_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "hash_count.hpp"
+#include "mapped_file.hpp"
+
+namespace hibp
+{
+    /**
+     * A sorted file of records that leaves out what the position of a
+     * record implies. Its layout, with all numbers big-endian:
+     *
+     *   - header: the magic `HIBPCMP1`, the digest size (32 bits),
+     *     zero (32 bits) and the number of records (64 bits)
+     *   - bucket table: `BucketCount` + 1 offsets (64 bits each) into
+     *     the record data; the records whose digests begin with the
+     *     20 bits b, i.e. those of `/range/` b, lie in [offset b,
+     *     offset b+1)
+     *   - record data: per record a head byte, whose high nibble holds
+     *     bits 20..23 of the digest and whose low nibble is the count
+     *     tag, the digest from its fourth byte on, and the count in
+     *     (tag - `MaxInlineCount`) bytes if the tag is greater than
+     *     `MaxInlineCount`, else the tag itself is the count
+     *
+     * A SHA-1 record thus takes 18 bytes instead of 24 unless its count
+     * is 12 or more, which costs one to four more bytes.
+     */
+    namespace compact
+    {
+        /** number of buckets, one per 5-hex-digit prefix */
+        constexpr std::size_t BucketCount = 0x100000;
+        constexpr std::size_t HeaderSize = 24;
+        constexpr std::size_t TableSize = (BucketCount + 1) * sizeof(std::uint64_t);
+        /** where the record data begins */
+        constexpr std::size_t DataOffset = HeaderSize + TableSize;
+        /** greatest count held by the tag itself */
+        constexpr unsigned MaxInlineCount = 11;
+
+        /**
+         * Digest size a file in the compact format was written with,
+         * or 0 if `filename` isn't one.
+         */
+        std::size_t digest_size(std::filesystem::path const &filename);
+    }
+
+    /**
+     * Writes records, which must come in ascending order, in the
+     * compact format. Records are encoded into a large buffer, and the
+     * bucket table is filled in by `close()`.
+     */
+    template <std::size_t DigestSize>
+    class basic_compact_writer final
+    {
+    public:
+        typedef basic_hash_count<DigestSize> record_type;
+
+        static constexpr std::size_t BufferSize = std::size_t{8} << 20;
+
+        /**
+         * Create `filename`, or truncate it.
+         * @throws std::runtime_error if it can't be opened
+         */
+        explicit basic_compact_writer(std::filesystem::path const &filename);
+        basic_compact_writer(basic_compact_writer const &) = delete;
+        basic_compact_writer &operator=(basic_compact_writer const &) = delete;
+
+        /**
+         * Append the `n` records at `first`.
+         * @throws std::runtime_error if a record is out of order or the
+         *         file can't be written
+         */
+        void write(record_type const *first, std::size_t n);
+
+        inline void write(basic_collection<DigestSize> const &hashes)
+        {
+            write(hashes.data(), hashes.size());
+        }
+
+        /**
+         * Write the header and the bucket table; without that the file
+         * is unusable.
+         * @throws std::runtime_error if the file can't be written
+         */
+        void close();
+
+        inline std::uint64_t records_written() const
+        {
+            return records_;
+        }
+
+        /** size of the file, once closed */
+        inline std::uint64_t bytes_written() const
+        {
+            return compact::DataOffset + data_size_;
+        }
+
+    private:
+        std::filesystem::path filename_;
+        std::ofstream out_;
+        std::vector<std::uint64_t> offsets_;
+        /** buckets whose offsets are known */
+        std::size_t next_bucket_{0};
+        std::vector<std::uint8_t> buf_;
+        std::size_t fill_{0};
+        /** record data written or buffered so far */
+        std::uint64_t data_size_{0};
+        std::uint64_t records_{0};
+        digest_t<DigestSize> previous_{};
+
+        void flush();
+    };
+
+    /**
+     * Reads a file in the compact format, mapped into memory, a bucket
+     * at a time.
+     */
+    template <std::size_t DigestSize>
+    class basic_compact_reader final
+    {
+    public:
+        /**
+         * @throws std::runtime_error if `filename` can't be mapped, isn't
+         *         in the compact format, holds digests of another size or
+         *         has an inconsistent bucket table
+         */
+        explicit basic_compact_reader(std::filesystem::path const &filename, access_pattern pattern = access_pattern::random);
+
+        inline std::uint64_t record_count() const
+        {
+            return record_count_;
+        }
+
+        inline std::size_t size_bytes() const
+        {
+            return file_.size();
+        }
+
+        /** see `mapped_file::advise()` */
+        inline void advise(access_pattern pattern)
+        {
+            file_.advise(pattern);
+        }
+
+        /**
+         * Append the records of `bucket`, i.e. those whose digests begin
+         * with the 20 bits `bucket`, to `out`.
+         * @return the number of records appended
+         * @throws std::runtime_error if the bucket is corrupt
+         */
+        std::size_t read(std::size_t bucket, basic_collection<DigestSize> &out) const;
+
+    private:
+        std::filesystem::path filename_;
+        mapped_file file_;
+        std::uint64_t record_count_{0};
+
+        std::uint64_t offset(std::size_t bucket) const;
+    };
+
+    struct conversion_stats
+    {
+        std::uint64_t records{0};
+        std::uint64_t input_bytes{0};
+        std::uint64_t output_bytes{0};
+        std::uint64_t elapsed_ns{0};
+    };
+
+    /**
+     * Convert the sorted records in `input`, as written by
+     * `basic_hash_count::dump()`, into the compact format.
+     * @throws std::runtime_error if `input` isn't sorted or a file can't
+     *         be read or written
+     */
+    template <std::size_t DigestSize>
+    conversion_stats convert_to_compact(std::filesystem::path const &input, std::filesystem::path const &output);
+
+    /**
+     * Convert a file in the compact format back into records as
+     * written by `basic_hash_count::dump()`.
+     * @throws std::runtime_error if a file can't be read or written
+     */
+    template <std::size_t DigestSize>
+    conversion_stats convert_from_compact(std::filesystem::path const &input, std::filesystem::path const &output);
+
+    typedef basic_compact_writer<Sha1Size> compact_writer;
+    typedef basic_compact_writer<NtlmSize> ntlm_compact_writer;
+    typedef basic_compact_reader<Sha1Size> compact_reader;
+    typedef basic_compact_reader<NtlmSize> ntlm_compact_reader;
+}
+
+#endif // __COMPACT_FORMAT_HPP__
@@ -0,0 +1,137 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "compression_advisor.hpp"
+
+namespace hibp
+{
+    double compression_advisor::sample::hashes_per_second() const
+    {
+        auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(last - first).count();
+        return ns <= 0
+                   ? 0.0
+                   : 1e9 * static_cast<double>(hashes) / static_cast<double>(ns);
+    }
+
+    compression_advisor::compression_advisor(compression_mode mode)
+        : mode_(mode)
+    {
+    }
+
+    void compression_advisor::set_mode(compression_mode mode)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        mode_ = mode;
+        decision_ = true;
+        probe();
+    }
+
+    compression_mode compression_advisor::mode() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return mode_;
+    }
+
+    bool compression_advisor::compress()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        switch (mode_)
+        {
+        case compression_mode::off:
+            return false;
+        case compression_mode::on:
+            return true;
+        default:
+            break;
+        }
+        switch (phase_)
+        {
+        case phase::probe_gzip:
+            return true;
+        case phase::probe_identity:
+            return false;
+        default:
+            break;
+        }
+        if (++sent_ >= ReprobeInterval)
+        {
+            probe();
+        }
+        return decision_;
+    }
+
+    std::optional<std::string> compression_advisor::record(bool compressed, std::uint64_t inflate_ns, std::size_t hashes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (mode_ != compression_mode::automatic || phase_ == phase::settled)
+        {
+            return std::nullopt;
+        }
+        if (compressed != (phase_ == phase::probe_gzip))
+        {
+            // sent before the current probe began
+            return std::nullopt;
+        }
+        sample &s = compressed ? gzip_ : identity_;
+        clock::time_point const now = clock::now();
+        if (s.first == clock::time_point{})
+        {
+            // the clock starts with the first response, which isn't
+            // counted because it was under way for an unknown time
+            s.first = now;
+            return std::nullopt;
+        }
+        ++s.requests;
+        s.hashes += hashes;
+        s.inflate_ns += inflate_ns;
+        s.last = now;
+        if (s.requests < ProbeSamples)
+        {
+            return std::nullopt;
+        }
+        if (phase_ == phase::probe_gzip)
+        {
+            phase_ = phase::probe_identity;
+            return std::nullopt;
+        }
+        return decide();
+    }
+
+    void compression_advisor::probe()
+    {
+        phase_ = phase::probe_gzip;
+        sent_ = 0;
+        gzip_ = sample{};
+        identity_ = sample{};
+    }
+
+    std::string compression_advisor::decide()
+    {
+        double const gzip = gzip_.hashes_per_second();
+        double const identity = identity_.hashes_per_second();
+        // the previous decision stands unless the other setting is clearly faster
+        bool const previous = decision_;
+        bool const compress = previous
+                                  ? gzip * (1.0 + Hysteresis) >= identity
+                                  : gzip > identity * (1.0 + Hysteresis);
+        phase_ = phase::settled;
+        decision_ = compress;
+        sent_ = 0;
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(0)
+           << "Compression probe: " << gzip << " hashes/s with gzip (inflating "
+           << std::setprecision(1) << 1e-3 * static_cast<double>(gzip_.inflate_ns) / static_cast<double>(std::max<std::size_t>(1, gzip_.requests))
+           << " µs per response), "
+           << std::setprecision(0) << identity << " hashes/s without; "
+           << (compress ? "asking for gzip" : "not asking for gzip")
+           << (compress == previous ? "" : " from now on")
+           << " for the next " << ReprobeInterval << " requests.";
+        return ss.str();
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __COMPRESSION_ADVISOR_HPP__
+#define __COMPRESSION_ADVISOR_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace hibp
+{
+    enum class compression_mode
+    {
+        off,
+        on,
+        /** whichever of the two yields more hashes per second */
+        automatic
+    };
+
+    /**
+     * Decides per request whether to ask for a gzip-compressed response.
+     *
+     * Compression pays off when the link is the bottleneck, but costs
+     * more than it saves when inflating is slower than the link, e.g.
+     * against a local mirror. In `compression_mode::automatic` the
+     * advisor therefore probes both settings one after the other,
+     * compares the hashes per second all workers together achieved with
+     * each, and sticks with the faster one until the next probe.
+     * Per-request latencies would be misleading here: with many
+     * requests in flight they are dominated by queueing, and they don't
+     * show how inflating slows down the other requests.
+     *
+     * Safe to use from all workers at once.
+     */
+    class compression_advisor final
+    {
+    public:
+        /** completed requests of each setting a probe needs for a decision */
+        static constexpr std::size_t ProbeSamples = 64;
+        /** requests sent with the chosen setting before probing again */
+        static constexpr std::size_t ReprobeInterval = 4096;
+        /** how much faster, relatively, the other setting has to be to change the decision */
+        static constexpr double Hysteresis = 0.05;
+
+        explicit compression_advisor(compression_mode mode = compression_mode::off);
+
+        void set_mode(compression_mode mode);
+
+        compression_mode mode() const;
+
+        /**
+         * Whether to ask for gzip in the next request.
+         */
+        bool compress();
+
+        /**
+         * Account for a completed request that was sent with `compressed`
+         * as returned by `compress()`.
+         * @param inflate_ns time spent inflating the response
+         * @param hashes number of records in the response
+         * @return the reasoning behind the decision if the request
+         *         completed a probe
+         */
+        std::optional<std::string> record(bool compressed, std::uint64_t inflate_ns, std::size_t hashes);
+
+    private:
+        using clock = std::chrono::steady_clock;
+        struct sample
+        {
+            std::size_t requests{0};
+            std::size_t hashes{0};
+            std::uint64_t inflate_ns{0};
+            clock::time_point first;
+            clock::time_point last;
+
+            double hashes_per_second() const;
+        };
+        enum class phase
+        {
+            probe_gzip,
+            probe_identity,
+            settled
+        };
+        mutable std::mutex mutex_;
+        compression_mode mode_;
+        phase phase_{phase::probe_gzip};
+        // setting to use between probes; favours gzip, which spares the server
+        bool decision_{true};
+        // requests sent since the last decision
+        std::size_t sent_{0};
+        sample gzip_;
+        sample identity_;
+
+        void probe();
+        std::string decide();
+    };
+}
+
+#endif // __COMPRESSION_ADVISOR_HPP__
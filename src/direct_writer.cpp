@@ -0,0 +1,298 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <stdexcept>
+
+#include "direct_writer.hpp"
+
+#if defined(__linux__) && defined(HIBPDL_WITH_LIBURING)
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace hibp
+{
+#if defined(__linux__) && defined(HIBPDL_WITH_LIBURING)
+    struct direct_writer::impl
+    {
+        /** a registered buffer and the write it's part of, if any */
+        struct slot
+        {
+            std::uint8_t *data{nullptr};
+            bool busy{false};
+            std::uint64_t offset{0};
+            std::size_t length{0};
+            std::size_t done{0};
+        };
+
+        std::string filename;
+        int fd{-1};
+        io_uring ring{};
+        bool ring_ready{false};
+        std::size_t buffer_size{0};
+        std::array<slot, QueueDepth> slots{};
+        unsigned in_flight{0};
+        /** the buffer being filled */
+        std::size_t current{0};
+        /** bytes in the current buffer */
+        std::size_t fill{0};
+        /** file offset of the current buffer, always aligned */
+        std::uint64_t offset{0};
+
+        ~impl()
+        {
+            if (ring_ready)
+            {
+                // a failed write may leave others in flight, which must
+                // complete before their buffers go away
+                while (in_flight > 0)
+                {
+                    io_uring_cqe *cqe = nullptr;
+                    if (io_uring_wait_cqe(&ring, &cqe) < 0)
+                    {
+                        break;
+                    }
+                    io_uring_cqe_seen(&ring, cqe);
+                    --in_flight;
+                }
+                io_uring_queue_exit(&ring);
+            }
+            for (slot &s : slots)
+            {
+                if (s.data != nullptr)
+                {
+                    ::operator delete(s.data, std::align_val_t{Alignment});
+                }
+            }
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+
+        [[noreturn]] void fail(int err) const
+        {
+            throw std::runtime_error("cannot write to " + filename + ": " + std::strerror(err));
+        }
+
+        void submit(std::size_t index)
+        {
+            slot &s = slots[index];
+            io_uring_sqe *const sqe = io_uring_get_sqe(&ring);
+            if (sqe == nullptr)
+            {
+                // can't happen with no more writes than entries in flight
+                fail(EBUSY);
+            }
+            io_uring_prep_write_fixed(sqe, fd, s.data + s.done, static_cast<unsigned>(s.length - s.done), s.offset + s.done, static_cast<int>(index));
+            io_uring_sqe_set_data(sqe, &s);
+            int const rc = io_uring_submit(&ring);
+            if (rc < 0)
+            {
+                fail(-rc);
+            }
+        }
+
+        void start(std::size_t index, std::size_t length)
+        {
+            slot &s = slots[index];
+            s.busy = true;
+            s.offset = offset;
+            s.length = length;
+            s.done = 0;
+            ++in_flight;
+            submit(index);
+        }
+
+        /** wait for one write to complete, resubmitting the rest of short ones */
+        void reap()
+        {
+            io_uring_cqe *cqe = nullptr;
+            int rc;
+            do
+            {
+                rc = io_uring_wait_cqe(&ring, &cqe);
+            } while (rc == -EINTR);
+            if (rc < 0)
+            {
+                fail(-rc);
+            }
+            slot &s = *static_cast<slot *>(io_uring_cqe_get_data(cqe));
+            int const res = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            if (res <= 0)
+            {
+                --in_flight;
+                s.busy = false;
+                fail(res == 0 ? EIO : -res);
+            }
+            s.done += static_cast<std::size_t>(res);
+            if (s.done < s.length)
+            {
+                submit(static_cast<std::size_t>(&s - slots.data()));
+                return;
+            }
+            s.busy = false;
+            --in_flight;
+        }
+
+        void drain()
+        {
+            while (in_flight > 0)
+            {
+                reap();
+            }
+        }
+    };
+
+    bool direct_writer::available()
+    {
+        return true;
+    }
+
+    std::unique_ptr<direct_writer> direct_writer::open(std::filesystem::path const &filename, std::string &reason, std::size_t buffer_size)
+    {
+        auto state = std::make_unique<impl>();
+        state->filename = filename.string();
+        state->buffer_size = std::max(Alignment, buffer_size / Alignment * Alignment);
+        state->fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_DIRECT | O_CLOEXEC, 0644);
+        if (state->fd < 0)
+        {
+            reason = errno == EINVAL
+                         ? std::string("the file system doesn't support O_DIRECT")
+                         : std::string("cannot open with O_DIRECT: ") + std::strerror(errno);
+            return nullptr;
+        }
+        int const rc = io_uring_queue_init(QueueDepth, &state->ring, 0);
+        if (rc < 0)
+        {
+            reason = std::string("io_uring is unavailable: ") + std::strerror(-rc);
+            return nullptr;
+        }
+        state->ring_ready = true;
+        std::array<iovec, QueueDepth> iov;
+        for (std::size_t i = 0; i < QueueDepth; ++i)
+        {
+            state->slots[i].data = static_cast<std::uint8_t *>(::operator new(state->buffer_size, std::align_val_t{Alignment}));
+            iov[i].iov_base = state->slots[i].data;
+            iov[i].iov_len = state->buffer_size;
+        }
+        int const reg = io_uring_register_buffers(&state->ring, iov.data(), QueueDepth);
+        if (reg < 0)
+        {
+            // typically RLIMIT_MEMLOCK
+            reason = std::string("cannot register io_uring buffers: ") + std::strerror(-reg);
+            return nullptr;
+        }
+        struct stat st;
+        if (::fstat(state->fd, &st) < 0)
+        {
+            reason = std::string("cannot stat: ") + std::strerror(errno);
+            return nullptr;
+        }
+        // start at the block the file ends in, with its contents, if any
+        std::uint64_t const size = static_cast<std::uint64_t>(st.st_size);
+        state->fill = static_cast<std::size_t>(size % Alignment);
+        state->offset = size - state->fill;
+        if (state->fill > 0 &&
+            ::pread(state->fd, state->slots[0].data, Alignment, static_cast<off_t>(state->offset)) != static_cast<ssize_t>(state->fill))
+        {
+            reason = std::string("cannot read the last block: ") + std::strerror(errno);
+            return nullptr;
+        }
+        return std::unique_ptr<direct_writer>(new direct_writer(std::move(state)));
+    }
+
+    void direct_writer::write(std::uint8_t const *data, std::size_t size)
+    {
+        impl &s = *impl_;
+        while (size > 0)
+        {
+            std::size_t const n = std::min(size, s.buffer_size - s.fill);
+            std::memcpy(s.slots[s.current].data + s.fill, data, n);
+            s.fill += n;
+            data += n;
+            size -= n;
+            if (s.fill == s.buffer_size)
+            {
+                s.start(s.current, s.buffer_size);
+                s.offset += s.buffer_size;
+                s.fill = 0;
+                s.current = (s.current + 1) % QueueDepth;
+                while (s.slots[s.current].busy)
+                {
+                    s.reap();
+                }
+            }
+        }
+    }
+
+    void direct_writer::flush()
+    {
+        impl &s = *impl_;
+        if (s.fill > 0)
+        {
+            std::size_t const padded = (s.fill + Alignment - 1) / Alignment * Alignment;
+            std::memset(s.slots[s.current].data + s.fill, 0, padded - s.fill);
+            s.start(s.current, padded);
+        }
+        s.drain();
+        if (::ftruncate(s.fd, static_cast<off_t>(s.offset + s.fill)) < 0)
+        {
+            s.fail(errno);
+        }
+        // the partial block goes out again with the next write
+        std::size_t const whole = s.fill / Alignment * Alignment;
+        std::memmove(s.slots[s.current].data, s.slots[s.current].data + whole, s.fill - whole);
+        s.offset += whole;
+        s.fill -= whole;
+    }
+#else
+    struct direct_writer::impl
+    {
+    };
+
+    bool direct_writer::available()
+    {
+        return false;
+    }
+
+    std::unique_ptr<direct_writer> direct_writer::open(std::filesystem::path const &, std::string &reason, std::size_t)
+    {
+#if defined(__linux__)
+        reason = "built without liburing";
+#else
+        reason = "io_uring is Linux only";
+#endif
+        return nullptr;
+    }
+
+    void direct_writer::write(std::uint8_t const *, std::size_t)
+    {
+        throw std::logic_error("direct_writer is unavailable");
+    }
+
+    void direct_writer::flush()
+    {
+        throw std::logic_error("direct_writer is unavailable");
+    }
+#endif
+
+    direct_writer::direct_writer(std::unique_ptr<impl> state)
+        : impl_(std::move(state))
+    {
+    }
+
+    direct_writer::~direct_writer() = default;
+}
@@ -0,0 +1,76 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __DIRECT_WRITER_HPP__
+#define __DIRECT_WRITER_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace hibp
+{
+    /**
+     * Appends to a file with `O_DIRECT` through io_uring, so that the
+     * data doesn't pass through, and evict other files from, the page
+     * cache. Linux only, and only if built with liburing.
+     *
+     * Data is collected in `QueueDepth` registered buffers aligned to
+     * `Alignment`; each full buffer is submitted at once, so that up to
+     * `QueueDepth` writes are in flight while the next buffer fills up.
+     * As `O_DIRECT` only writes whole aligned blocks, `flush()` pads the
+     * last, partial block with zeros, truncates the file to the actual
+     * end of the data afterwards, and keeps that block in memory to be
+     * written again, completed, by the next write. An existing file
+     * that doesn't end on a block boundary is handled the same way.
+     */
+    class direct_writer final
+    {
+    public:
+        /** alignment of file offsets, lengths and buffers; a page suits all common devices */
+        static constexpr std::size_t Alignment = 4096;
+        static constexpr std::size_t DefaultBufferSize = std::size_t{1} << 20;
+        static constexpr unsigned QueueDepth = 4;
+
+        /** whether this build can write with io_uring at all */
+        static bool available();
+
+        /**
+         * Open `filename` for appending, creating it if need be.
+         * @return `nullptr` if io_uring or `O_DIRECT` can't be used for
+         *         the file, with the reason in `reason`
+         */
+        static std::unique_ptr<direct_writer> open(std::filesystem::path const &filename,
+                                                   std::string &reason,
+                                                   std::size_t buffer_size = DefaultBufferSize);
+
+        direct_writer(direct_writer const &) = delete;
+        direct_writer &operator=(direct_writer const &) = delete;
+        ~direct_writer();
+
+        /**
+         * Append the `size` bytes at `data`, submitting buffers as they
+         * fill up.
+         * @throws std::runtime_error if a write fails
+         */
+        void write(std::uint8_t const *data, std::size_t size);
+
+        /**
+         * Write what's buffered and wait for all writes to complete.
+         * @throws std::runtime_error if a write fails
+         */
+        void flush();
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> impl_;
+
+        explicit direct_writer(std::unique_ptr<impl> state);
+    };
+}
+
+#endif // __DIRECT_WRITER_HPP__
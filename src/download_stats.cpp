@@ -0,0 +1,45 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <iomanip>
+
+#include "download_stats.hpp"
+
+namespace hibp
+{
+    std::ostream &operator<<(std::ostream &os, download_stats const &stats)
+    {
+        std::uint64_t const requests = std::max<std::uint64_t>(1, stats.requests.load());
+        std::uint64_t const connects = std::max<std::uint64_t>(1, stats.connects.load());
+        os << std::dec
+           << "Requests:              " << stats.requests.load() << '\n'
+           << "  over reused conn.:   " << stats.reused.load() << '\n'
+           << "  not modified:        " << stats.not_modified.load() << '\n'
+           << "Retries:               " << stats.retries.load() << '\n'
+           << "Failed ranges:         " << stats.failed.load() << '\n'
+           << "Connections opened:    " << stats.connects.load() << '\n'
+           << "  reconnects:          " << stats.reconnects.load() << '\n'
+           << "TLS handshakes (full): " << stats.handshakes.load() << '\n'
+           << "TLS handshakes (res.): " << stats.resumed.load() << '\n'
+           << std::fixed << std::setprecision(2)
+           << "Avg. request latency:  " << 1e-6 * static_cast<double>(stats.request_ns.load()) / static_cast<double>(requests) << " ms\n";
+        if (stats.setup_ns.load() > 0)
+        {
+            os << "Avg. setup time:       " << 1e-6 * static_cast<double>(stats.setup_ns.load()) / static_cast<double>(connects) << " ms per connection, "
+               << 100.0 * static_cast<double>(stats.setup_ns.load()) / static_cast<double>(std::max<std::uint64_t>(1, stats.request_ns.load())) << "% of total request latency\n";
+        }
+        os << "Body bytes received:   " << stats.body_bytes.load() << '\n';
+        if (stats.compressed_bytes.load() > 0)
+        {
+            os << "  gzip-compressed:     " << stats.compressed_bytes.load() << ", inflated to "
+               << stats.inflated_bytes.load() << " (ratio "
+               << static_cast<double>(stats.inflated_bytes.load()) / static_cast<double>(stats.compressed_bytes.load()) << ")\n"
+               << "Inflate time:          " << 1e-6 * static_cast<double>(stats.inflate_ns.load()) << " ms, "
+               << 1e3 * static_cast<double>(stats.inflated_bytes.load()) / static_cast<double>(std::max<std::uint64_t>(1, stats.inflate_ns.load())) << " MB/s\n";
+        }
+        return os;
+    }
+}
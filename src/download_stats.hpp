@@ -0,0 +1,55 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __DOWNLOAD_STATS_HPP__
+#define __DOWNLOAD_STATS_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+namespace hibp
+{
+    /**
+     * Counters shared by all workers of a download run.
+     */
+    struct download_stats
+    {
+        /** completed HTTP requests */
+        std::atomic<std::uint64_t> requests{0};
+        /** ranges answered with 304 Not Modified */
+        std::atomic<std::uint64_t> not_modified{0};
+        /** failed attempts that have been scheduled for another try */
+        std::atomic<std::uint64_t> retries{0};
+        /** ranges given up after exhausting the retry policy */
+        std::atomic<std::uint64_t> failed{0};
+        /** requests sent over a connection that had served a request before */
+        std::atomic<std::uint64_t> reused{0};
+        /** TCP connections opened */
+        std::atomic<std::uint64_t> connects{0};
+        /** connections opened to replace one that had been closed */
+        std::atomic<std::uint64_t> reconnects{0};
+        /** full TLS handshakes */
+        std::atomic<std::uint64_t> handshakes{0};
+        /** abbreviated TLS handshakes resuming an earlier session */
+        std::atomic<std::uint64_t> resumed{0};
+        /** total time spent connecting and handshaking */
+        std::atomic<std::uint64_t> setup_ns{0};
+        /** total time from sending a request until its response was complete, setup included */
+        std::atomic<std::uint64_t> request_ns{0};
+        /** bytes of the 200 responses' bodies as received, i.e. compressed or not */
+        std::atomic<std::uint64_t> body_bytes{0};
+        /** part of `body_bytes` that was gzip-compressed */
+        std::atomic<std::uint64_t> compressed_bytes{0};
+        /** what `compressed_bytes` inflated to */
+        std::atomic<std::uint64_t> inflated_bytes{0};
+        /** total time spent inflating */
+        std::atomic<std::uint64_t> inflate_ns{0};
+    };
+
+    std::ostream &operator<<(std::ostream &, download_stats const &);
+}
+
+#endif // __DOWNLOAD_STATS_HPP__
@@ -0,0 +1,83 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <array>
+#include <fstream>
+#include <limits>
+
+#include "etag_store.hpp"
+#include "util.hpp"
+
+namespace hibp
+{
+    namespace
+    {
+        constexpr std::array<char, 8> Magic{'H', 'I', 'B', 'P', 'E', 'T', 'G', '1'};
+    }
+
+    etag_store::etag_store()
+        : etags_(RangeCount), last_modified_(RangeCount, 0)
+    {
+    }
+
+    void etag_store::set(std::size_t range, std::string const &etag, std::string const &last_modified)
+    {
+        etags_[range] = etag.size() <= std::numeric_limits<std::uint8_t>::max() ? etag : std::string{};
+        std::optional<std::time_t> const t = util::parse_http_date(last_modified);
+        last_modified_[range] = t.has_value() && *t > 0 && *t <= std::numeric_limits<std::uint32_t>::max()
+                                    ? static_cast<std::uint32_t>(*t)
+                                    : 0;
+    }
+
+    bool etag_store::load(std::filesystem::path const &filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        std::array<char, Magic.size()> magic{};
+        if (!in.read(magic.data(), magic.size()) || magic != Magic)
+        {
+            return false;
+        }
+        std::vector<std::string> etags(RangeCount);
+        std::vector<std::uint32_t> last_modified(RangeCount);
+        for (std::size_t range = 0; range < RangeCount; ++range)
+        {
+            std::array<unsigned char, 5> head;
+            if (!in.read(reinterpret_cast<char *>(head.data()), head.size()))
+            {
+                return false;
+            }
+            last_modified[range] = static_cast<std::uint32_t>(head[0]) << 24 | static_cast<std::uint32_t>(head[1]) << 16 | static_cast<std::uint32_t>(head[2]) << 8 | head[3];
+            etags[range].resize(head[4]);
+            if (!in.read(etags[range].data(), head[4]))
+            {
+                return false;
+            }
+        }
+        etags_.swap(etags);
+        last_modified_.swap(last_modified);
+        return true;
+    }
+
+    bool etag_store::save(std::filesystem::path const &filename) const
+    {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        out.write(Magic.data(), Magic.size());
+        for (std::size_t range = 0; range < RangeCount; ++range)
+        {
+            std::uint32_t const t = last_modified_[range];
+            std::array<char, 5> const head{
+                static_cast<char>(t >> 24),
+                static_cast<char>(t >> 16),
+                static_cast<char>(t >> 8),
+                static_cast<char>(t),
+                static_cast<char>(etags_[range].size())};
+            out.write(head.data(), head.size());
+            out.write(etags_[range].data(), static_cast<std::streamsize>(etags_[range].size()));
+        }
+        // so that a failure to flush the rest shows, too
+        out.close();
+        return static_cast<bool>(out);
+    }
+}
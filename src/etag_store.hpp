@@ -0,0 +1,92 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __ETAG_STORE_HPP__
+#define __ETAG_STORE_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace hibp
+{
+    /**
+     * `ETag` and `Last-Modified` of every range, kept in a sidecar file
+     * next to the output so that a later run can ask the server whether
+     * a range has changed at all.
+     *
+     * Different ranges may be updated from different threads at the same
+     * time; a single range must not.
+     *
+     * File layout: the magic "HIBPETG1", then for each of the 2^20 ranges
+     * in ascending order the Last-Modified time as a big-endian 32-bit
+     * Unix timestamp (0 if unknown), the length of the ETag as one byte
+     * and the ETag itself.
+     */
+    class etag_store final
+    {
+    public:
+        static constexpr std::size_t RangeCount = 0x100000;
+
+        etag_store();
+
+        bool load(std::filesystem::path const &filename);
+        bool save(std::filesystem::path const &filename) const;
+
+        inline std::string const &etag(std::size_t range) const
+        {
+            return etags_[range];
+        }
+
+        inline std::time_t last_modified(std::size_t range) const
+        {
+            return static_cast<std::time_t>(last_modified_[range]);
+        }
+
+        /**
+         * Whether a conditional request can be made for `range`.
+         */
+        inline bool known(std::size_t range) const
+        {
+            return !etags_[range].empty() || last_modified_[range] != 0;
+        }
+
+        /**
+         * Remember the validators of `range`; `last_modified` is the raw
+         * header value. ETags longer than 255 bytes are dropped.
+         */
+        void set(std::size_t range, std::string const &etag, std::string const &last_modified);
+
+        /**
+         * Take over the validators of `range` from `other`.
+         */
+        inline void copy(std::size_t range, etag_store const &other)
+        {
+            etags_[range] = other.etags_[range];
+            last_modified_[range] = other.last_modified_[range];
+        }
+
+        /**
+         * Forget the validators of the ranges [`first`, `last`).
+         */
+        inline void forget(std::size_t first, std::size_t last)
+        {
+            for (std::size_t range = first; range < last; ++range)
+            {
+                etags_[range].clear();
+                last_modified_[range] = 0;
+            }
+        }
+
+    private:
+        std::vector<std::string> etags_;
+        std::vector<std::uint32_t> last_modified_;
+    };
+}
+
+#endif // __ETAG_STORE_HPP__
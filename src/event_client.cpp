@@ -0,0 +1,950 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include "event_client.hpp"
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+
+namespace hibp
+{
+    namespace
+    {
+        constexpr std::size_t ReadChunkSize = 16 * 1024;
+
+        bool iequals(std::string_view a, std::string_view b)
+        {
+            return a.size() == b.size() &&
+                   std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                              { return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y)); });
+        }
+
+        std::string_view trim(std::string_view s)
+        {
+            while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            {
+                s.remove_prefix(1);
+            }
+            while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            {
+                s.remove_suffix(1);
+            }
+            return s;
+        }
+
+        std::string ssl_error_string()
+        {
+            char buf[256];
+            ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+            return buf;
+        }
+
+        /**
+         * Incremental parser for a single HTTP/1.1 response,
+         * fed with whatever the socket delivers.
+         */
+        class response_reader final
+        {
+        public:
+            void reset()
+            {
+                state_ = state::status_line;
+                buf_.clear();
+                pos_ = 0;
+                remaining_ = 0;
+                keep_alive_ = true;
+                response_ = http_response{};
+            }
+
+            /**
+             * Hand the body to `sink` piece by piece as it arrives instead
+             * of collecting it in `response().body`; `nullptr` to collect.
+             */
+            void stream_to(event_client::body_sink const *sink, event_client::request const *req)
+            {
+                sink_ = sink;
+                req_ = req;
+            }
+
+            /**
+             * @return `false` if the data violates the protocol
+             */
+            bool feed(char const *data, std::size_t size)
+            {
+                buf_.append(data, size);
+                bool ok = process();
+                buf_.erase(0, pos_);
+                pos_ = 0;
+                return ok;
+            }
+
+            /**
+             * Tell the reader that the peer has closed the connection.
+             *
+             * @return `true` if that completes the response
+             */
+            bool close()
+            {
+                if (state_ == state::body_until_close)
+                {
+                    state_ = state::done;
+                }
+                return done();
+            }
+
+            inline bool done() const
+            {
+                return state_ == state::done;
+            }
+
+            inline bool pristine() const
+            {
+                return state_ == state::status_line && buf_.empty();
+            }
+
+            inline bool keep_alive() const
+            {
+                return keep_alive_;
+            }
+
+            inline http_response &response()
+            {
+                return response_;
+            }
+
+        private:
+            enum class state
+            {
+                status_line,
+                headers,
+                body,
+                chunk_size,
+                chunk_data,
+                chunk_end,
+                trailers,
+                body_until_close,
+                done
+            };
+            state state_{state::status_line};
+            std::string buf_;
+            std::size_t pos_{0};
+            std::size_t remaining_{0};
+            bool keep_alive_{true};
+            http_response response_;
+            event_client::body_sink const *sink_{nullptr};
+            event_client::request const *req_{nullptr};
+
+            void emit_body(std::size_t n)
+            {
+                if (sink_ != nullptr)
+                {
+                    (*sink_)(*req_, response_, std::string_view(buf_).substr(pos_, n));
+                }
+                else
+                {
+                    response_.body.append(buf_, pos_, n);
+                }
+                pos_ += n;
+            }
+
+            bool next_line(std::string_view &line)
+            {
+                std::size_t const eol = buf_.find("\r\n", pos_);
+                if (eol == std::string::npos)
+                {
+                    return false;
+                }
+                line = std::string_view(buf_).substr(pos_, eol - pos_);
+                pos_ = eol + 2;
+                return true;
+            }
+
+            void consume_body(state next)
+            {
+                std::size_t const n = std::min(remaining_, buf_.size() - pos_);
+                emit_body(n);
+                remaining_ -= n;
+                if (remaining_ == 0)
+                {
+                    state_ = next;
+                }
+            }
+
+            bool begin_body()
+            {
+                int const status = response_.status;
+                if ((status >= 100 && status < 200) || status == 204 || status == 304)
+                {
+                    state_ = state::done;
+                    return true;
+                }
+                if (iequals(response_.header("Transfer-Encoding"), "chunked"))
+                {
+                    state_ = state::chunk_size;
+                    return true;
+                }
+                std::string const content_length = response_.header("Content-Length");
+                if (content_length.empty())
+                {
+                    keep_alive_ = false;
+                    state_ = state::body_until_close;
+                    return true;
+                }
+                char *end = nullptr;
+                remaining_ = std::strtoull(content_length.c_str(), &end, 10);
+                if (end == content_length.c_str())
+                {
+                    return false;
+                }
+                if (sink_ == nullptr)
+                {
+                    response_.body.reserve(remaining_);
+                }
+                state_ = remaining_ > 0 ? state::body : state::done;
+                return true;
+            }
+
+            bool process()
+            {
+                std::string_view line;
+                for (;;)
+                {
+                    switch (state_)
+                    {
+                    case state::status_line:
+                        if (!next_line(line))
+                        {
+                            return true;
+                        }
+                        // e.g. "HTTP/1.1 200 OK"
+                        if (line.size() < 12 || line.substr(0, 7) != "HTTP/1.")
+                        {
+                            return false;
+                        }
+                        keep_alive_ = line[7] != '0';
+                        response_.status = std::atoi(std::string(line.substr(9, 3)).c_str());
+                        state_ = state::headers;
+                        break;
+                    case state::headers:
+                        if (!next_line(line))
+                        {
+                            return true;
+                        }
+                        if (line.empty())
+                        {
+                            if (!begin_body())
+                            {
+                                return false;
+                            }
+                        }
+                        else
+                        {
+                            std::size_t const colon = line.find(':');
+                            if (colon == std::string_view::npos)
+                            {
+                                return false;
+                            }
+                            std::string_view const name = trim(line.substr(0, colon));
+                            std::string_view const value = trim(line.substr(colon + 1));
+                            if (iequals(name, "Connection"))
+                            {
+                                keep_alive_ = !iequals(value, "close");
+                            }
+                            response_.headers.emplace_back(name, value);
+                        }
+                        break;
+                    case state::body:
+                        consume_body(state::done);
+                        if (state_ == state::body)
+                        {
+                            return true;
+                        }
+                        break;
+                    case state::chunk_size:
+                    {
+                        if (!next_line(line))
+                        {
+                            return true;
+                        }
+                        std::string const size_str(line.substr(0, line.find(';')));
+                        char *end = nullptr;
+                        remaining_ = std::strtoull(size_str.c_str(), &end, 16);
+                        if (end == size_str.c_str())
+                        {
+                            return false;
+                        }
+                        state_ = remaining_ > 0 ? state::chunk_data : state::trailers;
+                        break;
+                    }
+                    case state::chunk_data:
+                        consume_body(state::chunk_end);
+                        if (state_ == state::chunk_data)
+                        {
+                            return true;
+                        }
+                        break;
+                    case state::chunk_end:
+                        if (!next_line(line))
+                        {
+                            return true;
+                        }
+                        if (!line.empty())
+                        {
+                            return false;
+                        }
+                        state_ = state::chunk_size;
+                        break;
+                    case state::trailers:
+                        if (!next_line(line))
+                        {
+                            return true;
+                        }
+                        if (line.empty())
+                        {
+                            state_ = state::done;
+                        }
+                        break;
+                    case state::body_until_close:
+                        emit_body(buf_.size() - pos_);
+                        return true;
+                    case state::done:
+                        return true;
+                    }
+                }
+            }
+        };
+    }
+
+    std::string http_response::header(std::string_view name) const
+    {
+        for (auto const &[key, value] : headers)
+        {
+            if (iequals(key, name))
+            {
+                return value;
+            }
+        }
+        return std::string();
+    }
+
+    struct event_client::connection
+    {
+        enum class phase
+        {
+            closed,
+            connecting,
+            handshaking,
+            idle,
+            sending,
+            receiving
+        };
+        std::uint32_t index{0};
+        std::uint32_t generation{0};
+        int fd{-1};
+        SSL *ssl{nullptr};
+        phase state{phase::closed};
+        std::uint32_t events{0};
+        bool busy{false};
+        bool reused{false};
+        bool had_connection{false};
+        /** address being connected to; the following ones are left to try */
+        addrinfo const *addr{nullptr};
+        request req;
+        std::string out;
+        std::size_t out_pos{0};
+        response_reader reader;
+        std::string error;
+        std::chrono::steady_clock::time_point connect_started;
+        std::chrono::steady_clock::time_point request_started;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    namespace
+    {
+        std::uint64_t nanoseconds_since(std::chrono::steady_clock::time_point t0)
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        }
+    }
+
+    event_client::event_client(std::string const &url, std::size_t max_connections)
+        : max_connections_(std::max<std::size_t>(1, max_connections))
+    {
+        std::string_view rest(url);
+        std::size_t const scheme_end = rest.find("://");
+        std::string_view scheme = "http";
+        if (scheme_end != std::string_view::npos)
+        {
+            scheme = rest.substr(0, scheme_end);
+            rest.remove_prefix(scheme_end + 3);
+        }
+        if (scheme == "https")
+        {
+            use_tls_ = true;
+        }
+        else if (scheme != "http")
+        {
+            throw std::runtime_error("unsupported URL scheme `" + std::string(scheme) + "`");
+        }
+        rest = rest.substr(0, rest.find('/'));
+        std::size_t const colon = rest.rfind(':');
+        if (colon != std::string_view::npos && rest.find(']', colon) == std::string_view::npos)
+        {
+            host_ = rest.substr(0, colon);
+            port_ = rest.substr(colon + 1);
+        }
+        else
+        {
+            host_ = rest;
+            port_ = use_tls_ ? "443" : "80";
+        }
+        if (host_.size() > 2 && host_.front() == '[' && host_.back() == ']')
+        {
+            host_ = host_.substr(1, host_.size() - 2);
+        }
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int const rc = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &addr_);
+        if (rc != 0)
+        {
+            throw std::runtime_error("cannot resolve `" + host_ + "`: " + gai_strerror(rc));
+        }
+
+        if (use_tls_)
+        {
+            ssl_ctx_ = SSL_CTX_new(TLS_client_method());
+            if (ssl_ctx_ == nullptr)
+            {
+                freeaddrinfo(addr_);
+                throw std::runtime_error("SSL_CTX_new() failed: " + ssl_error_string());
+            }
+            SSL_CTX_set_min_proto_version(ssl_ctx_, TLS1_2_VERSION);
+            SSL_CTX_set_default_verify_paths(ssl_ctx_);
+            SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_PEER, nullptr);
+            SSL_CTX_set_mode(ssl_ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            // Keep the most recent session (ticket) ourselves to offer it on the
+            // next connection; OpenSSL's internal cache is of no use to clients.
+            SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(ssl_ctx_, &event_client::on_new_session);
+            SSL_CTX_set_app_data(ssl_ctx_, this);
+        }
+
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0)
+        {
+            if (ssl_ctx_ != nullptr)
+            {
+                SSL_CTX_free(ssl_ctx_);
+            }
+            freeaddrinfo(addr_);
+            throw std::runtime_error(std::string("epoll_create1() failed: ") + std::strerror(errno));
+        }
+    }
+
+    event_client::~event_client()
+    {
+        ::close(epoll_fd_);
+        if (session_ != nullptr)
+        {
+            SSL_SESSION_free(session_);
+        }
+        if (ssl_ctx_ != nullptr)
+        {
+            SSL_CTX_free(ssl_ctx_);
+        }
+        freeaddrinfo(addr_);
+    }
+
+    int event_client::on_new_session(SSL *ssl, SSL_SESSION *session)
+    {
+        auto *self = static_cast<event_client *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        if (self->session_ != nullptr)
+        {
+            SSL_SESSION_free(self->session_);
+        }
+        self->session_ = session;
+        // returning 1 means we've taken ownership of the session
+        return 1;
+    }
+
+    void event_client::run(request_source source, response_sink on_response, error_sink on_error, std::atomic_bool const &quit)
+    {
+        using clock = std::chrono::steady_clock;
+        std::vector<connection> conns(max_connections_);
+        for (std::size_t i = 0; i < conns.size(); ++i)
+        {
+            conns[i].index = static_cast<std::uint32_t>(i);
+        }
+        std::vector<epoll_event> events(conns.size());
+
+        auto fail = [this, &on_error](connection &c)
+        {
+            close(c);
+            c.busy = false;
+            on_error(c.req, c.error);
+        };
+
+        // A failure before the first byte of the response has arrived over a
+        // connection that has been used before most likely means that the server
+        // has dropped the idle keep-alive connection. That's no reason to fail the
+        // request, just reconnect and try again.
+        // get ready to send `c.req` from its first byte on
+        auto rewind = [this](connection &c)
+        {
+            c.out_pos = 0;
+            c.reader.reset();
+            c.reader.stream_to(body_sink_ ? &body_sink_ : nullptr, &c.req);
+        };
+
+        auto retry_or_fail = [this, &fail, &rewind](connection &c)
+        {
+            if (c.reused && c.reader.pristine())
+            {
+                close(c);
+                c.reused = false;
+                rewind(c);
+                if (open(c))
+                {
+                    return;
+                }
+            }
+            fail(c);
+        };
+
+        auto start = [this, &retry_or_fail, &rewind, &on_response](connection &c)
+        {
+            c.busy = true;
+            c.request_started = clock::now();
+            c.deadline = c.request_started + timeout_;
+            c.out = "GET " + c.req.path + " HTTP/1.1\r\n"
+                    "Host: " + host_ + "\r\n"
+                    "User-Agent: " + user_agent_ + "\r\n"
+                    "Accept: */*\r\n"
+                    "Connection: keep-alive\r\n";
+            for (auto const &[name, value] : c.req.headers)
+            {
+                c.out += name + ": " + value + "\r\n";
+            }
+            c.out += "\r\n";
+            rewind(c);
+            c.reused = c.state == connection::phase::idle;
+            if (c.reused)
+            {
+                ++stats_->reused;
+                c.state = connection::phase::sending;
+                if (!drive(c, on_response))
+                {
+                    retry_or_fail(c);
+                }
+            }
+            else if (!open(c))
+            {
+                retry_or_fail(c);
+            }
+        };
+
+        while (!quit.load())
+        {
+            bool no_more_requests = false;
+            bool starved = false;
+            std::size_t busy = 0;
+            for (connection &c : conns)
+            {
+                if (!c.busy && !starved && !no_more_requests)
+                {
+                    switch (source(c.req))
+                    {
+                    case next_request::ok:
+                        start(c);
+                        break;
+                    case next_request::wait:
+                        starved = true;
+                        break;
+                    case next_request::done:
+                        no_more_requests = true;
+                        break;
+                    }
+                }
+                if (c.busy)
+                {
+                    ++busy;
+                }
+            }
+            if (busy == 0 && no_more_requests)
+            {
+                break;
+            }
+            int const n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), busy > 0 ? 100 : 10);
+            if (n < 0 && errno != EINTR)
+            {
+                throw std::runtime_error(std::string("epoll_wait() failed: ") + std::strerror(errno));
+            }
+            for (int i = 0; i < n; ++i)
+            {
+                std::uint64_t const tag = events[static_cast<std::size_t>(i)].data.u64;
+                connection &c = conns[tag >> 32];
+                if (static_cast<std::uint32_t>(tag) != c.generation || c.state == connection::phase::closed)
+                {
+                    // stale event of a socket that has been closed in the meantime
+                    continue;
+                }
+                if (!drive(c, on_response))
+                {
+                    retry_or_fail(c);
+                }
+            }
+            auto const now = clock::now();
+            for (connection &c : conns)
+            {
+                if (c.busy && now > c.deadline)
+                {
+                    c.error = "request timed out";
+                    fail(c);
+                }
+            }
+        }
+        for (connection &c : conns)
+        {
+            close(c);
+        }
+    }
+
+    bool event_client::open(connection &c)
+    {
+        ++stats_->connects;
+        if (c.had_connection)
+        {
+            ++stats_->reconnects;
+        }
+        c.had_connection = true;
+        c.connect_started = std::chrono::steady_clock::now();
+        c.addr = addr_;
+        return connect_next(c);
+    }
+
+    /**
+     * Start connecting to `c.addr`, or to the addresses following it
+     * if that fails right away.
+     *
+     * @return `false` if there's no address left to try; `c.error`
+     *         tells why the last one failed
+     */
+    bool event_client::connect_next(connection &c)
+    {
+        for (; c.addr != nullptr; c.addr = c.addr->ai_next)
+        {
+            close(c);
+            ++c.generation;
+            c.fd = ::socket(c.addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, c.addr->ai_protocol);
+            if (c.fd < 0)
+            {
+                c.error = std::string("socket() failed: ") + std::strerror(errno);
+                continue;
+            }
+            int const one = 1;
+            setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            c.state = connection::phase::connecting;
+            c.events = 0;
+            epoll_event ev{};
+            ev.events = EPOLLOUT;
+            ev.data.u64 = (static_cast<std::uint64_t>(c.index) << 32) | c.generation;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev) < 0)
+            {
+                c.error = std::string("epoll_ctl() failed: ") + std::strerror(errno);
+                continue;
+            }
+            c.events = EPOLLOUT;
+            if (::connect(c.fd, c.addr->ai_addr, c.addr->ai_addrlen) < 0 && errno != EINPROGRESS)
+            {
+                c.error = std::string("connect() failed: ") + std::strerror(errno);
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void event_client::close(connection &c)
+    {
+        if (c.ssl != nullptr)
+        {
+            SSL_free(c.ssl);
+            c.ssl = nullptr;
+        }
+        if (c.fd >= 0)
+        {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c.fd, nullptr);
+            ::close(c.fd);
+            c.fd = -1;
+        }
+        c.state = connection::phase::closed;
+    }
+
+    void event_client::watch(connection &c, std::uint32_t events)
+    {
+        if (c.events == events)
+        {
+            return;
+        }
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = (static_cast<std::uint64_t>(c.index) << 32) | c.generation;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+        c.events = events;
+    }
+
+    /**
+     * Advance the connection's state machine as far as possible
+     * without blocking.
+     *
+     * @return `false` if the request failed; `c.error` tells why
+     */
+    bool event_client::drive(connection &c, response_sink const &on_response)
+    {
+        for (;;)
+        {
+            switch (c.state)
+            {
+            case connection::phase::closed:
+                return true;
+            case connection::phase::connecting:
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+                {
+                    c.error = std::string("connect() failed: ") + std::strerror(err != 0 ? err : errno);
+                    // e.g. the server listens on IPv4 only, but the name
+                    // resolved to an IPv6 address first
+                    c.addr = c.addr->ai_next;
+                    return connect_next(c);
+                }
+                if (use_tls_)
+                {
+                    c.ssl = SSL_new(ssl_ctx_);
+                    SSL_set_fd(c.ssl, c.fd);
+                    SSL_set_tlsext_host_name(c.ssl, host_.c_str());
+                    SSL_set1_host(c.ssl, host_.c_str());
+                    SSL_set_connect_state(c.ssl);
+                    if (session_ != nullptr)
+                    {
+                        SSL_set_session(c.ssl, session_);
+                    }
+                    c.state = connection::phase::handshaking;
+                }
+                else
+                {
+                    stats_->setup_ns += nanoseconds_since(c.connect_started);
+                    c.state = connection::phase::sending;
+                }
+                break;
+            }
+            case connection::phase::handshaking:
+                if (!handshake(c))
+                {
+                    return false;
+                }
+                if (c.state == connection::phase::handshaking)
+                {
+                    return true;
+                }
+                break;
+            case connection::phase::sending:
+                if (!send_request(c))
+                {
+                    return false;
+                }
+                if (c.state == connection::phase::sending)
+                {
+                    return true;
+                }
+                break;
+            case connection::phase::receiving:
+                return receive_response(c, on_response);
+            case connection::phase::idle:
+                // an idle keep-alive connection only becomes readable
+                // if the server has closed it
+                close(c);
+                return true;
+            }
+        }
+    }
+
+    bool event_client::handshake(connection &c)
+    {
+        ERR_clear_error();
+        int const rc = SSL_do_handshake(c.ssl);
+        if (rc == 1)
+        {
+            stats_->setup_ns += nanoseconds_since(c.connect_started);
+            if (SSL_session_reused(c.ssl))
+            {
+                ++stats_->resumed;
+            }
+            else
+            {
+                ++stats_->handshakes;
+            }
+            c.state = connection::phase::sending;
+            return true;
+        }
+        switch (SSL_get_error(c.ssl, rc))
+        {
+        case SSL_ERROR_WANT_READ:
+            watch(c, EPOLLIN);
+            return true;
+        case SSL_ERROR_WANT_WRITE:
+            watch(c, EPOLLOUT);
+            return true;
+        default:
+            c.error = "TLS handshake failed: " + ssl_error_string();
+            return false;
+        }
+    }
+
+    bool event_client::send_request(connection &c)
+    {
+        while (c.out_pos < c.out.size())
+        {
+            char const *data = c.out.data() + c.out_pos;
+            std::size_t const size = c.out.size() - c.out_pos;
+            if (c.ssl != nullptr)
+            {
+                ERR_clear_error();
+                int const n = SSL_write(c.ssl, data, static_cast<int>(size));
+                if (n <= 0)
+                {
+                    switch (SSL_get_error(c.ssl, n))
+                    {
+                    case SSL_ERROR_WANT_READ:
+                        watch(c, EPOLLIN);
+                        return true;
+                    case SSL_ERROR_WANT_WRITE:
+                        watch(c, EPOLLOUT);
+                        return true;
+                    default:
+                        c.error = "SSL_write() failed: " + ssl_error_string();
+                        return false;
+                    }
+                }
+                c.out_pos += static_cast<std::size_t>(n);
+            }
+            else
+            {
+                ssize_t const n = ::send(c.fd, data, size, MSG_NOSIGNAL);
+                if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        watch(c, EPOLLOUT);
+                        return true;
+                    }
+                    c.error = std::string("send() failed: ") + std::strerror(errno);
+                    return false;
+                }
+                c.out_pos += static_cast<std::size_t>(n);
+            }
+        }
+        c.state = connection::phase::receiving;
+        watch(c, EPOLLIN);
+        return true;
+    }
+
+    bool event_client::receive_response(connection &c, response_sink const &on_response)
+    {
+        char buf[ReadChunkSize];
+        bool eof = false;
+        while (!c.reader.done() && !eof)
+        {
+            if (c.ssl != nullptr)
+            {
+                ERR_clear_error();
+                int const n = SSL_read(c.ssl, buf, sizeof(buf));
+                if (n <= 0)
+                {
+                    switch (SSL_get_error(c.ssl, n))
+                    {
+                    case SSL_ERROR_WANT_READ:
+                        watch(c, EPOLLIN);
+                        return true;
+                    case SSL_ERROR_WANT_WRITE:
+                        watch(c, EPOLLOUT);
+                        return true;
+                    case SSL_ERROR_ZERO_RETURN:
+                        eof = true;
+                        continue;
+                    default:
+                        c.error = "SSL_read() failed: " + ssl_error_string();
+                        return false;
+                    }
+                }
+                if (!c.reader.feed(buf, static_cast<std::size_t>(n)))
+                {
+                    c.error = "malformed HTTP response";
+                    return false;
+                }
+            }
+            else
+            {
+                ssize_t const n = ::recv(c.fd, buf, sizeof(buf), 0);
+                if (n < 0)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        return true;
+                    }
+                    c.error = std::string("recv() failed: ") + std::strerror(errno);
+                    return false;
+                }
+                if (n == 0)
+                {
+                    eof = true;
+                    continue;
+                }
+                if (!c.reader.feed(buf, static_cast<std::size_t>(n)))
+                {
+                    c.error = "malformed HTTP response";
+                    return false;
+                }
+            }
+        }
+        if (eof && !c.reader.close())
+        {
+            c.error = "connection closed by peer";
+            return false;
+        }
+        c.busy = false;
+        ++stats_->requests;
+        stats_->request_ns += nanoseconds_since(c.request_started);
+        if (c.reader.keep_alive() && !eof)
+        {
+            c.state = connection::phase::idle;
+            watch(c, EPOLLIN | EPOLLRDHUP);
+        }
+        else
+        {
+            close(c);
+        }
+        on_response(c.req, c.reader.response());
+        return true;
+    }
+}
+
+#endif // __linux__
@@ -0,0 +1,151 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __EVENT_CLIENT_HPP__
+#define __EVENT_CLIENT_HPP__
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <netdb.h>
+#include <openssl/ssl.h>
+
+#include "download_stats.hpp"
+
+namespace hibp
+{
+    struct http_response
+    {
+        int status{0};
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;
+
+        /**
+         * Value of the first header named `name` (case-insensitive),
+         * or an empty string if there's no such header.
+         */
+        std::string header(std::string_view name) const;
+    };
+
+    /**
+     * Non-blocking HTTP/1.1 client that keeps many GET requests in flight
+     * on a single thread, each on its own keep-alive connection, driven
+     * by epoll. Speaks plain HTTP and HTTPS (via OpenSSL). New TLS
+     * connections resume the most recent session, so that reconnecting
+     * after the server has closed a connection is cheap.
+     */
+    class event_client final
+    {
+    public:
+        struct request
+        {
+            std::size_t id;
+            std::string path;
+            /** sent in addition to the default headers */
+            std::vector<std::pair<std::string, std::string>> headers;
+        };
+
+        enum class next_request
+        {
+            /** `request` has been filled in */
+            ok,
+            /** nothing to do right now, ask again later */
+            wait,
+            /** no more requests will follow */
+            done
+        };
+
+        using request_source = std::function<next_request(request &)>;
+        using response_sink = std::function<void(request const &, http_response &)>;
+        using error_sink = std::function<void(request const &, std::string const &)>;
+        using body_sink = std::function<void(request const &, http_response const &, std::string_view)>;
+
+        /**
+         * @param url scheme, host and optional port, e.g. `https://api.pwnedpasswords.com`
+         * @param max_connections maximum number of requests in flight
+         */
+        event_client(std::string const &url, std::size_t max_connections);
+        event_client(event_client const &) = delete;
+        event_client(event_client &&) = delete;
+        ~event_client();
+
+        inline void set_user_agent(std::string const &user_agent)
+        {
+            user_agent_ = user_agent;
+        }
+
+        inline void set_timeout(std::chrono::milliseconds timeout)
+        {
+            timeout_ = timeout;
+        }
+
+        /**
+         * Count connections, handshakes and requests in `stats`.
+         */
+        inline void set_stats(download_stats *stats)
+        {
+            stats_ = stats;
+        }
+
+        /**
+         * Pass response bodies to `sink` in pieces as they arrive, instead
+         * of collecting them in `http_response::body`. The status and
+         * headers are complete by the time the first piece comes in.
+         * A request that fails after that still ends up in `on_error`.
+         */
+        inline void set_body_sink(body_sink sink)
+        {
+            body_sink_ = std::move(sink);
+        }
+
+        /**
+         * Pull requests from `source` until it returns `next_request::done`
+         * and all requests in flight have completed, or `quit` becomes true.
+         * Every request ends up in exactly one call of either `on_response`
+         * or `on_error`.
+         */
+        void run(request_source source, response_sink on_response, error_sink on_error, std::atomic_bool const &quit);
+
+    private:
+        struct connection;
+
+        std::string host_;
+        std::string port_;
+        bool use_tls_{false};
+        std::size_t max_connections_;
+        std::string user_agent_;
+        std::chrono::milliseconds timeout_{30'000};
+        addrinfo *addr_{nullptr};
+        SSL_CTX *ssl_ctx_{nullptr};
+        SSL_SESSION *session_{nullptr};
+        int epoll_fd_{-1};
+        download_stats local_stats_;
+        download_stats *stats_{&local_stats_};
+        body_sink body_sink_;
+
+        static int on_new_session(SSL *, SSL_SESSION *);
+
+        bool open(connection &);
+        bool connect_next(connection &);
+        void close(connection &);
+        void watch(connection &, std::uint32_t events);
+        bool drive(connection &, response_sink const &);
+        bool handshake(connection &);
+        bool send_request(connection &);
+        bool receive_response(connection &, response_sink const &);
+    };
+}
+
+#endif // __linux__
+
+#endif // __EVENT_CLIENT_HPP__
@@ -0,0 +1,382 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __FAST_RESPONSE_PARSER_HPP__
+#define __FAST_RESPONSE_PARSER_HPP__
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "hash_count.hpp"
+#include "response_parser.hpp"
+#include "simd.hpp"
+#include "util.hpp"
+
+namespace hibp
+{
+    /**
+     * Drop-in replacement for `basic_response_parser` that works line by
+     * line instead of character by character: each line's suffix is
+     * hex-decoded and its count converted with the SIMD kernels the CPU
+     * supports.
+     *
+     * The body can be passed in one piece to `parse()`, or as it arrives
+     * in chunks of any size to `feed()`, followed by `finish()`. Records
+     * are appended to the collection passed to `begin()`, so one parser
+     * can be reused for any number of responses without allocating.
+     *
+     * `parse()` hands a body that isn't strictly `SUFFIX:COUNT` lines
+     * separated by CR/LF to `basic_response_parser` instead, so that both
+     * always produce the same records. When streaming, such a body
+     * makes `failed()` return `true`.
+     */
+    template <std::size_t DigestSize>
+    class basic_fast_response_parser final
+    {
+        /** hex digits per line, i.e. the digest minus the 5-digit prefix */
+        static constexpr std::size_t SuffixLength = 2 * DigestSize - 5;
+        /** longest line that can be valid */
+        static constexpr std::size_t MaxLineLength = SuffixLength + 1 + simd::MaxCountDigits;
+        /**
+         * bytes that have to be left for `parse_canonical()` to take on
+         * a line: the suffix plus the padding the hex kernels may read
+         * beyond it, which also covers the colon and the 16 bytes the
+         * count kernel loads
+         */
+        static constexpr std::size_t CanonicalSlack = SuffixLength + 1 + simd::HexPadding;
+        static_assert(simd::HexPadding >= 16);
+
+    public:
+        typedef basic_collection<DigestSize> collection_type;
+
+        basic_fast_response_parser()
+        {
+            hex_hash_.fill('0');
+        }
+
+        explicit basic_fast_response_parser(hash_prefix_t const &prefix)
+            : basic_fast_response_parser()
+        {
+            begin(prefix, own_);
+        }
+
+        basic_fast_response_parser(basic_fast_response_parser const &) = delete;
+        basic_fast_response_parser &operator=(basic_fast_response_parser const &) = delete;
+
+        /**
+         * Parse `source` into a collection of its own.
+         */
+        collection_type const &parse(std::string_view source)
+        {
+            own_.clear();
+            own_.reserve(source.size() / (SuffixLength + 4));
+            parse(prefix_, source, own_);
+            return own_;
+        }
+
+        /**
+         * Parse `source`, the response for `prefix`, and append its
+         * records to `out`.
+         * @return the number of records appended
+         */
+        std::size_t parse(hash_prefix_t const &prefix, std::string_view source, collection_type &out)
+        {
+            begin(prefix, out);
+            feed(source);
+            if (!finish())
+            {
+                basic_response_parser<DigestSize> fallback(prefix_);
+                collection_type const &result = fallback.parse(source);
+                out.insert(out.end(), result.begin(), result.end());
+                written_ = result.size();
+                failed_ = false;
+            }
+            return written_;
+        }
+
+        /**
+         * Start parsing the response for `prefix`, appending its records
+         * to `out`. Records of other prefixes may be appended to `out`
+         * in the meantime, e.g. by other parsers.
+         */
+        void begin(hash_prefix_t const &prefix, collection_type &out)
+        {
+            prefix_ = prefix;
+            std::copy(prefix.begin(), prefix.end(), hex_hash_.begin());
+            out_ = &out;
+            first_ = out.size();
+            written_ = 0;
+            carry_size_ = 0;
+            failed_ = false;
+        }
+
+        /**
+         * Parse the complete lines in `chunk`; an incomplete last line
+         * is kept until the next call.
+         */
+        void feed(std::string_view chunk)
+        {
+            if (failed_)
+            {
+                return;
+            }
+            char const *p = chunk.data();
+            char const *const end = p + chunk.size();
+            if (carry_size_ > 0)
+            {
+                // complete the line begun in the previous chunk
+                char const *eol = p;
+                while (eol < end && !is_eol(*eol))
+                {
+                    ++eol;
+                }
+                std::size_t const n = static_cast<std::size_t>(eol - p);
+                if (carry_size_ + n > MaxLineLength)
+                {
+                    fail();
+                    return;
+                }
+                std::memcpy(carry_.data() + carry_size_, p, n);
+                carry_size_ += n;
+                if (eol == end)
+                {
+                    return;
+                }
+                parse_carry();
+                p = eol;
+            }
+            p = parse_lines(p, end, false);
+            if (p != nullptr)
+            {
+                carry_size_ = static_cast<std::size_t>(end - p);
+                std::memcpy(carry_.data(), p, carry_size_);
+            }
+        }
+
+        /**
+         * Parse what's left over from the last chunk.
+         * @return `false` if the body was malformed, in which case none
+         *         of its records remain in the output collection
+         */
+        bool finish()
+        {
+            if (!failed_ && carry_size_ > 0)
+            {
+                parse_carry();
+            }
+            carry_size_ = 0;
+            return !failed_;
+        }
+
+        /**
+         * Remove the records of the current response from the output
+         * collection, e.g. because the download broke off.
+         */
+        void discard()
+        {
+            if (written_ == 0)
+            {
+                return;
+            }
+            collection_type &out = *out_;
+            if (out.size() - first_ == written_)
+            {
+                out.resize(first_);
+            }
+            else
+            {
+                // other responses have been appended in between
+                std::uint32_t const range = prefix_value();
+                out.erase(std::remove_if(out.begin() + static_cast<std::ptrdiff_t>(first_), out.end(),
+                                         [range](basic_hash_count<DigestSize> const &h)
+                                         { return range_of(h) == range; }),
+                          out.end());
+            }
+            written_ = 0;
+        }
+
+        inline bool failed() const
+        {
+            return failed_;
+        }
+
+        /**
+         * Number of records of the current response appended so far.
+         */
+        inline std::size_t written() const
+        {
+            return written_;
+        }
+
+        collection_type const &result() const
+        {
+            return own_;
+        }
+
+    private:
+        hash_prefix_t prefix_{'0', '0', '0', '0', '0'};
+        collection_type own_;
+        collection_type *out_{&own_};
+        // size of `*out_` when the current response began
+        std::size_t first_{0};
+        std::size_t written_{0};
+        // start of a line whose end hasn't arrived yet
+        std::array<char, MaxLineLength> carry_;
+        std::size_t carry_size_{0};
+        bool failed_{false};
+        // prefix and suffix of the current line, padded for the vector loads
+        alignas(32) std::array<char, 2 * DigestSize + simd::HexPadding> hex_hash_;
+
+        static inline bool is_eol(char c)
+        {
+            return c == '\r' || c == '\n';
+        }
+
+        static inline std::uint32_t range_of(basic_hash_count<DigestSize> const &h)
+        {
+            return static_cast<std::uint32_t>(h.data[0]) << 12 |
+                   static_cast<std::uint32_t>(h.data[1]) << 4 |
+                   static_cast<std::uint32_t>(h.data[2]) >> 4;
+        }
+
+        std::uint32_t prefix_value() const
+        {
+            std::uint32_t value = 0;
+            for (char c : prefix_)
+            {
+                value = value << 4 | ::util::hex2nibble(c);
+            }
+            return value;
+        }
+
+        void fail()
+        {
+            discard();
+            failed_ = true;
+        }
+
+        void parse_carry()
+        {
+            std::size_t const n = carry_size_;
+            carry_size_ = 0;
+            parse_lines(carry_.data(), carry_.data() + n, true);
+        }
+
+        /**
+         * Parse lines as long as they have the exact layout the API sends,
+         * `SUFFIX:COUNT` followed by CRLF, and are far enough from `end`
+         * that nothing needs to be bounds-checked: each line takes a
+         * fixed-size decode and one wide load for the count.
+         * @return the beginning of the first line that doesn't qualify
+         */
+        char const *parse_canonical(char const *p, char const *const end, simd::kernels const &k, collection_type &out)
+        {
+            // the prefix makes up the first two and a half bytes of every
+            // digest, so only the suffix' first digit needs to be merged
+            // in; the rest is decoded in place
+            std::uint8_t const b0 = static_cast<std::uint8_t>(::util::hex2nibble(prefix_[0]) << 4 | ::util::hex2nibble(prefix_[1]));
+            std::uint8_t const b1 = static_cast<std::uint8_t>(::util::hex2nibble(prefix_[2]) << 4 | ::util::hex2nibble(prefix_[3]));
+            std::uint8_t const b2 = static_cast<std::uint8_t>(::util::hex2nibble(prefix_[4]) << 4);
+            basic_hash_count<DigestSize> record;
+            record.data[0] = b0;
+            record.data[1] = b1;
+            while (static_cast<std::size_t>(end - p) >= CanonicalSlack && p[SuffixLength] == ':')
+            {
+                std::uint8_t const first = ::util::HexValues[static_cast<unsigned char>(p[0])];
+                if (first == ::util::NotHex || !k.decode_hex(p + 1, record.data.data() + 3, DigestSize - 3))
+                {
+                    break;
+                }
+                record.data[2] = static_cast<std::uint8_t>(b2 | first);
+                char const *const count = p + SuffixLength + 1;
+                std::size_t const digits = k.parse_count(count, 16, record.count);
+                if (digits == 0 || count[digits] != '\r' || count[digits + 1] != '\n')
+                {
+                    break;
+                }
+                out.push_back(record);
+                ++written_;
+                p = count + digits + 2;
+            }
+            return p;
+        }
+
+        /**
+         * Parse the lines in [`p`, `end`). Unless `last` is set, the last
+         * line may continue in the next chunk.
+         * @return the beginning of an incomplete last line, or `nullptr`
+         *         if there's none or the data is malformed
+         */
+        char const *parse_lines(char const *p, char const *const end, bool last)
+        {
+            simd::kernels const &k = simd::active();
+            collection_type &out = *out_;
+            basic_hash_count<DigestSize> record;
+            while (p < end)
+            {
+                p = parse_canonical(p, end, k, out);
+                if (p == end)
+                {
+                    break;
+                }
+                // anything else, e.g. a bare LF, takes the general path
+                if (is_eol(*p))
+                {
+                    ++p;
+                    continue;
+                }
+                if (static_cast<std::size_t>(end - p) < SuffixLength + 2)
+                {
+                    if (last)
+                    {
+                        fail();
+                        return nullptr;
+                    }
+                    return p;
+                }
+                if (p[SuffixLength] != ':')
+                {
+                    fail();
+                    return nullptr;
+                }
+                std::memcpy(hex_hash_.data() + prefix_.size(), p, SuffixLength);
+                if (!k.decode_hex(hex_hash_.data(), record.data.data(), DigestSize))
+                {
+                    fail();
+                    return nullptr;
+                }
+                char const *const count = p + SuffixLength + 1;
+                std::size_t const digits = k.parse_count(count, static_cast<std::size_t>(end - count), record.count);
+                if (digits == 0)
+                {
+                    fail();
+                    return nullptr;
+                }
+                if (count + digits == end && !last)
+                {
+                    // more digits may follow in the next chunk
+                    return p;
+                }
+                if (count + digits < end && !is_eol(count[digits]))
+                {
+                    fail();
+                    return nullptr;
+                }
+                out.push_back(record);
+                ++written_;
+                p = count + digits;
+            }
+            return nullptr;
+        }
+    };
+
+    typedef basic_fast_response_parser<Sha1Size> fast_response_parser;
+    typedef basic_fast_response_parser<NtlmSize> ntlm_fast_response_parser;
+}
+
+#endif // __FAST_RESPONSE_PARSER_HPP__
@@ -3,7 +3,7 @@
  * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
  */
 
-#include <iomanip>
+#include <array>
 
 #if defined(__unix__) || defined(__APPLE__)
 #include <arpa/inet.h>
@@ -13,17 +13,17 @@
 #endif
 
 #include "hash_count.hpp"
+#include "util.hpp"
 
 namespace hibp
 {
 
-    std::ostream &operator<<(std::ostream &os, sha1_t const &hp)
+    template <std::size_t DigestSize>
+    std::ostream &operator<<(std::ostream &os, digest_t<DigestSize> const &hp)
     {
-        for (sha1_t::value_type const c : hp)
-        {
-            os << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(c);
-        }
-        return os;
+        std::array<char, 2 * DigestSize> hex;
+        ::util::hex_encode(hp, hex, true);
+        return os.write(hex.data(), static_cast<std::streamsize>(hex.size()));
     }
 
     std::ostream &operator<<(std::ostream &os, hash_prefix_t const &hp)
@@ -35,14 +35,16 @@ namespace hibp
         return os;
     }
 
-    void hash_count::dump(std::ostream &os) const
+    template <std::size_t DigestSize>
+    void basic_hash_count<DigestSize>::dump(std::ostream &os) const
     {
         os.write(reinterpret_cast<char const *>(data.data()), data.size());
         uint32_t const cn = htonl(count);
         os.write(reinterpret_cast<char const *>(&cn), sizeof(cn));
     }
 
-    hash_count &hash_count::read(std::istream &is)
+    template <std::size_t DigestSize>
+    basic_hash_count<DigestSize> &basic_hash_count<DigestSize>::read(std::istream &is)
     {
         is.read(reinterpret_cast<char*>(data.data()), data.size());
         uint32_t cn = 0;
@@ -50,4 +52,9 @@ namespace hibp
         count = ntohl(cn);
         return *this;
     }
+
+    template struct basic_hash_count<Sha1Size>;
+    template struct basic_hash_count<NtlmSize>;
+    template std::ostream &operator<<(std::ostream &, digest_t<Sha1Size> const &);
+    template std::ostream &operator<<(std::ostream &, digest_t<NtlmSize> const &);
 }
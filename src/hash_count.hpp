@@ -3,37 +3,74 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <vector>
 
 namespace hibp
 {
-    typedef std::array<std::uint8_t, 20> sha1_t;
+    /** size of a SHA-1 digest in bytes */
+    constexpr std::size_t Sha1Size = 20;
+    /** size of an NTLM (MD4) digest in bytes */
+    constexpr std::size_t NtlmSize = 16;
 
-    struct hash_count
+    template <std::size_t DigestSize>
+    using digest_t = std::array<std::uint8_t, DigestSize>;
+
+    typedef digest_t<Sha1Size> sha1_t;
+    typedef digest_t<NtlmSize> ntlm_t;
+
+    /**
+     * A digest along with the number of times it has been seen in
+     * breaches. Written to disk as the raw digest followed by the count
+     * as a big-endian 32-bit number.
+     */
+    template <std::size_t DigestSize>
+    struct basic_hash_count
     {
-        sha1_t data;
+        static constexpr std::size_t digest_size = DigestSize;
+
+        digest_t<DigestSize> data;
         std::uint32_t count{0};
 
         void dump(std::ostream &) const;
-        hash_count &read(std::istream &);
+        basic_hash_count &read(std::istream &);
     };
 
-    typedef std::vector<hash_count> collection_t;
+    typedef basic_hash_count<Sha1Size> hash_count;
+    typedef basic_hash_count<NtlmSize> ntlm_hash_count;
+
+    template <std::size_t DigestSize>
+    using basic_collection = std::vector<basic_hash_count<DigestSize>>;
+
+    typedef basic_collection<Sha1Size> collection_t;
+    typedef basic_collection<NtlmSize> ntlm_collection_t;
     typedef std::array<char, 5> hash_prefix_t;
 
-    std::ostream &operator<<(std::ostream &, sha1_t const &);
+    template <std::size_t DigestSize>
+    std::ostream &operator<<(std::ostream &, digest_t<DigestSize> const &);
     std::ostream &operator<<(std::ostream &, hash_prefix_t const &);
 
     struct smallest_hash_first
     {
-        bool operator()(const hash_count &lhs, const hash_count &rhs)
+        template <std::size_t DigestSize>
+        bool operator()(const basic_hash_count<DigestSize> &lhs, const basic_hash_count<DigestSize> &rhs)
         {
             return std::lexicographical_compare(lhs.data.begin(), lhs.data.end(), rhs.data.begin(), rhs.data.end());
         }
     };
 
+    /**
+     * Query string that selects the dataset of `DigestSize` in the
+     * Pwned Passwords API.
+     */
+    template <std::size_t DigestSize>
+    constexpr char const *mode_query()
+    {
+        static_assert(DigestSize == Sha1Size || DigestSize == NtlmSize, "unsupported digest size");
+        return DigestSize == NtlmSize ? "?mode=ntlm" : "";
+    }
 }
 
 #endif // __HASH_COUNT_HPP__
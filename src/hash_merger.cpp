@@ -0,0 +1,392 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "hash_merger.hpp"
+#include "mapped_records.hpp"
+#include "radix_sort.hpp"
+#include "timer.hpp"
+
+namespace fs = std::filesystem;
+
+namespace hibp
+{
+    namespace
+    {
+        inline std::uint32_t load_be32(unsigned char const *p)
+        {
+            return static_cast<std::uint32_t>(p[0]) << 24 |
+                   static_cast<std::uint32_t>(p[1]) << 16 |
+                   static_cast<std::uint32_t>(p[2]) << 8 |
+                   static_cast<std::uint32_t>(p[3]);
+        }
+
+        inline void store_be32(unsigned char *p, std::uint32_t v)
+        {
+            p[0] = static_cast<unsigned char>(v >> 24);
+            p[1] = static_cast<unsigned char>(v >> 16);
+            p[2] = static_cast<unsigned char>(v >> 8);
+            p[3] = static_cast<unsigned char>(v);
+        }
+
+        /**
+         * Hands out the records of a mapped file one by one.
+         */
+        template <std::size_t DigestSize>
+        class record_cursor final
+        {
+        public:
+            explicit record_cursor(fs::path const &filename)
+                : records_(filename, access_pattern::sequential),
+                  pos_(records_.data()),
+                  end_(records_.data() + records_.size_bytes())
+            {
+            }
+
+            /** the current record, or `nullptr` at the end of the file */
+            inline unsigned char const *peek() const
+            {
+                return pos_ < end_ ? pos_ : nullptr;
+            }
+
+            inline void pop()
+            {
+                pos_ += basic_mapped_records<DigestSize>::RecordSize;
+            }
+
+            inline std::uint64_t bytes_read() const
+            {
+                return static_cast<std::uint64_t>(pos_ - records_.data());
+            }
+
+        private:
+            // moving the mapping leaves it where it is, so the pointers stay valid
+            basic_mapped_records<DigestSize> records_;
+            unsigned char const *pos_;
+            unsigned char const *end_;
+        };
+
+        /**
+         * Collects records and writes them in large blocks.
+         */
+        template <std::size_t RecordSize>
+        class record_writer final
+        {
+        public:
+            record_writer(fs::path const &filename, std::size_t buffer_size)
+                : filename_(filename),
+                  out_(filename, std::ios::binary | std::ios::trunc),
+                  buf_(std::max<std::size_t>(1, buffer_size / RecordSize) * RecordSize)
+            {
+                if (!out_)
+                {
+                    throw std::runtime_error("cannot open " + filename.string() + " for writing");
+                }
+            }
+
+            /** room for the next record, which is written by `push()` */
+            inline unsigned char *next()
+            {
+                if (pos_ == buf_.size())
+                {
+                    flush();
+                }
+                return buf_.data() + pos_;
+            }
+
+            inline void push()
+            {
+                pos_ += RecordSize;
+            }
+
+            void flush()
+            {
+                out_.write(reinterpret_cast<char const *>(buf_.data()), static_cast<std::streamsize>(pos_));
+                if (!out_)
+                {
+                    throw std::runtime_error("cannot write to " + filename_.string());
+                }
+                bytes_written_ += pos_;
+                pos_ = 0;
+            }
+
+            inline std::uint64_t bytes_written() const
+            {
+                return bytes_written_;
+            }
+
+        private:
+            fs::path filename_;
+            std::ofstream out_;
+            std::vector<unsigned char> buf_;
+            std::size_t pos_{0};
+            std::uint64_t bytes_written_{0};
+        };
+
+        /**
+         * Tournament tree over k sorted sources whose inner nodes keep
+         * the loser of the match played there, so that replacing the
+         * winner takes one match per level on the way up from its leaf.
+         * The number of leaves is rounded up to a power of two; the
+         * surplus ones are exhausted sources from the start.
+         */
+        template <std::size_t DigestSize, std::size_t RecordSize>
+        class loser_tree final
+        {
+        public:
+            explicit loser_tree(std::vector<record_cursor<DigestSize>> &sources)
+                : sources_(sources)
+            {
+                while (leaves_ < sources.size())
+                {
+                    leaves_ *= 2;
+                }
+                tree_.resize(leaves_);
+                tree_[0] = leaves_ == 1 ? 0 : build(1);
+            }
+
+            /** the smallest current record, or `nullptr` if all sources are exhausted */
+            inline unsigned char const *top() const
+            {
+                return record(tree_[0]);
+            }
+
+            /** advance the winner's source and find the new winner */
+            void pop()
+            {
+                std::size_t winner = tree_[0];
+                sources_[winner].pop();
+                for (std::size_t node = (winner + leaves_) / 2; node > 0; node /= 2)
+                {
+                    if (less(tree_[node], winner))
+                    {
+                        std::swap(tree_[node], winner);
+                    }
+                }
+                tree_[0] = winner;
+            }
+
+        private:
+            std::vector<record_cursor<DigestSize>> &sources_;
+            std::size_t leaves_{1};
+            std::vector<std::size_t> tree_;
+
+            inline unsigned char const *record(std::size_t source) const
+            {
+                return source < sources_.size() ? sources_[source].peek() : nullptr;
+            }
+
+            /** whether source `a`'s record goes before `b`'s; ties go to the lower index */
+            bool less(std::size_t a, std::size_t b) const
+            {
+                unsigned char const *const ra = record(a);
+                unsigned char const *const rb = record(b);
+                if (ra == nullptr || rb == nullptr)
+                {
+                    return rb == nullptr && (ra != nullptr || a < b);
+                }
+                int const c = std::memcmp(ra, rb, DigestSize);
+                return c < 0 || (c == 0 && a < b);
+            }
+
+            /** play the matches below `node` and return the winner */
+            std::size_t build(std::size_t node)
+            {
+                if (node >= leaves_)
+                {
+                    return node - leaves_;
+                }
+                std::size_t const left = build(2 * node);
+                std::size_t const right = build(2 * node + 1);
+                if (less(left, right))
+                {
+                    tree_[node] = right;
+                    return left;
+                }
+                tree_[node] = left;
+                return right;
+            }
+        };
+    }
+
+    double merge_stats::mb_per_second() const
+    {
+        return elapsed_ns == 0
+                   ? 0.0
+                   : 1e3 * static_cast<double>(input_bytes) / static_cast<double>(elapsed_ns);
+    }
+
+    template <std::size_t DigestSize>
+    basic_hash_merger<DigestSize>::basic_hash_merger(duplicate_policy policy, std::size_t memory_limit)
+        : policy_(policy), memory_limit_(memory_limit)
+    {
+    }
+
+    template <std::size_t DigestSize>
+    merge_stats basic_hash_merger<DigestSize>::merge(std::vector<fs::path> const &inputs, fs::path const &output)
+    {
+        util::timer t;
+        merge_stats stats;
+        stats.inputs = inputs.size();
+        fs::path const temp_directory = temp_directory_.empty()
+                                            ? fs::absolute(output).parent_path()
+                                            : temp_directory_;
+        std::vector<fs::path> sources;
+        std::vector<fs::path> runs;
+        for (fs::path const &input : inputs)
+        {
+            if (fs::exists(output) && fs::equivalent(input, output))
+            {
+                throw std::runtime_error("output file " + output.string() + " is also an input");
+            }
+            std::uintmax_t const size = fs::file_size(input);
+            if (size % RecordSize != 0)
+            {
+                throw std::runtime_error("size of " + input.string() + " isn't a multiple of " + std::to_string(RecordSize));
+            }
+            stats.input_bytes += size;
+            if (is_sorted(input, stats))
+            {
+                sources.push_back(input);
+                continue;
+            }
+            ++stats.unsorted_inputs;
+            fs::path const prefix = temp_directory / (output.filename().string() + ".run" + std::to_string(stats.unsorted_inputs) + "-");
+            std::vector<fs::path> const input_runs = sort_runs(input, prefix, stats);
+            sources.insert(sources.end(), input_runs.begin(), input_runs.end());
+            runs.insert(runs.end(), input_runs.begin(), input_runs.end());
+        }
+        try
+        {
+            merge_sorted(sources, output, stats);
+        }
+        catch (...)
+        {
+            for (fs::path const &run : runs)
+            {
+                fs::remove(run);
+            }
+            throw;
+        }
+        for (fs::path const &run : runs)
+        {
+            fs::remove(run);
+        }
+        stats.elapsed_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.elapsed()).count());
+        return stats;
+    }
+
+    template <std::size_t DigestSize>
+    bool basic_hash_merger<DigestSize>::is_sorted(fs::path const &input, merge_stats &stats) const
+    {
+        record_cursor<DigestSize> in(input);
+        std::array<unsigned char, DigestSize> previous;
+        bool first = true;
+        bool sorted = true;
+        for (unsigned char const *p = in.peek(); p != nullptr && sorted; in.pop(), p = in.peek())
+        {
+            sorted = first || std::memcmp(previous.data(), p, DigestSize) <= 0;
+            std::memcpy(previous.data(), p, DigestSize);
+            first = false;
+        }
+        stats.bytes_read += in.bytes_read();
+        return sorted;
+    }
+
+    template <std::size_t DigestSize>
+    std::vector<fs::path> basic_hash_merger<DigestSize>::sort_runs(fs::path const &input, fs::path const &prefix, merge_stats &stats) const
+    {
+        // the radix sort needs a second buffer of the same size
+        std::size_t const run_records = std::max<std::size_t>(1, memory_limit_ / (2 * sizeof(basic_hash_count<DigestSize>)));
+        record_cursor<DigestSize> in(input);
+        std::vector<fs::path> runs;
+        basic_collection<DigestSize> hashes;
+        hashes.reserve(run_records);
+        while (in.peek() != nullptr)
+        {
+            hashes.clear();
+            for (unsigned char const *p = in.peek(); p != nullptr && hashes.size() < run_records; in.pop(), p = in.peek())
+            {
+                basic_hash_count<DigestSize> &h = hashes.emplace_back();
+                std::memcpy(h.data.data(), p, DigestSize);
+                h.count = load_be32(p + DigestSize);
+            }
+            radix_sort(hashes);
+            fs::path const run = prefix.string() + std::to_string(runs.size());
+            runs.push_back(run);
+            record_writer<RecordSize> out(run, std::size_t{16} << 20);
+            for (basic_hash_count<DigestSize> const &h : hashes)
+            {
+                unsigned char *const p = out.next();
+                std::memcpy(p, h.data.data(), DigestSize);
+                store_be32(p + DigestSize, h.count);
+                out.push();
+            }
+            out.flush();
+            stats.bytes_written += out.bytes_written();
+        }
+        stats.bytes_read += in.bytes_read();
+        stats.runs += runs.size();
+        return runs;
+    }
+
+    template <std::size_t DigestSize>
+    void basic_hash_merger<DigestSize>::merge_sorted(std::vector<fs::path> const &sources, fs::path const &output, merge_stats &stats) const
+    {
+        std::vector<record_cursor<DigestSize>> readers;
+        readers.reserve(sources.size());
+        for (fs::path const &source : sources)
+        {
+            readers.emplace_back(source);
+        }
+        record_writer<RecordSize> out(output, std::max(MinBufferSize, std::min(memory_limit_, std::size_t{16} << 20)));
+        loser_tree<DigestSize, RecordSize> tree(readers);
+        // the record last written is held back until its duplicates are merged in
+        unsigned char *pending = nullptr;
+        for (unsigned char const *p = tree.top(); p != nullptr; tree.pop(), p = tree.top())
+        {
+            ++stats.records_in;
+            if (pending != nullptr && std::memcmp(pending, p, DigestSize) == 0)
+            {
+                ++stats.duplicates;
+                std::uint64_t const a = load_be32(pending + DigestSize);
+                std::uint64_t const b = load_be32(p + DigestSize);
+                std::uint64_t const merged = policy_ == duplicate_policy::sum
+                                                 ? std::min<std::uint64_t>(a + b, std::numeric_limits<std::uint32_t>::max())
+                                                 : std::max(a, b);
+                store_be32(pending + DigestSize, static_cast<std::uint32_t>(merged));
+                continue;
+            }
+            if (pending != nullptr)
+            {
+                out.push();
+                ++stats.records_out;
+            }
+            pending = out.next();
+            std::memcpy(pending, p, RecordSize);
+        }
+        if (pending != nullptr)
+        {
+            out.push();
+            ++stats.records_out;
+        }
+        out.flush();
+        stats.bytes_written += out.bytes_written();
+        for (record_cursor<DigestSize> const &reader : readers)
+        {
+            stats.bytes_read += reader.bytes_read();
+        }
+    }
+
+    template class basic_hash_merger<Sha1Size>;
+    template class basic_hash_merger<NtlmSize>;
+}
@@ -0,0 +1,107 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __HASH_MERGER_HPP__
+#define __HASH_MERGER_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+
+#include "hash_count.hpp"
+
+namespace hibp
+{
+    /**
+     * What to do with the counts of a hash found in more than one place.
+     */
+    enum class duplicate_policy
+    {
+        sum,
+        max
+    };
+
+    struct merge_stats
+    {
+        /** input files */
+        std::size_t inputs{0};
+        /** inputs that had to be sorted before merging */
+        std::size_t unsorted_inputs{0};
+        /** sorted runs the unsorted inputs were split into */
+        std::size_t runs{0};
+        /** total size of the input files */
+        std::uint64_t input_bytes{0};
+        std::uint64_t records_in{0};
+        std::uint64_t records_out{0};
+        /** records whose hash had already been written, and whose count was merged into that */
+        std::uint64_t duplicates{0};
+        /** bytes read, rereads of sorted runs and the order check included */
+        std::uint64_t bytes_read{0};
+        std::uint64_t bytes_written{0};
+        std::uint64_t elapsed_ns{0};
+
+        /** size of the inputs per second of wall time */
+        double mb_per_second() const;
+    };
+
+    /**
+     * Merges any number of files of records as written by
+     * `basic_hash_count::dump()` into one sorted file without
+     * duplicates, in bounded memory.
+     *
+     * Each input is first checked for order in one sequential pass.
+     * Sorted inputs are merged directly; unsorted ones are sorted
+     * externally first: they're read in pieces that fit into the memory
+     * limit, each piece is sorted with `radix_sort()` and written to a
+     * temporary run file, and the runs take part in the merge in place
+     * of the input. The merge itself streams all sources through a
+     * loser tree, so each record costs about log2(sources) comparisons.
+     * All inputs and runs are read through `basic_mapped_records`, i.e.
+     * straight from the page cache, which the OS is free to evict.
+     */
+    template <std::size_t DigestSize>
+    class basic_hash_merger final
+    {
+    public:
+        /** size of a record in the files */
+        static constexpr std::size_t RecordSize = DigestSize + sizeof(std::uint32_t);
+        static constexpr std::size_t DefaultMemoryLimit = std::size_t{512} << 20;
+        /** smallest output buffer, however low the memory limit */
+        static constexpr std::size_t MinBufferSize = std::size_t{64} << 10;
+
+        explicit basic_hash_merger(duplicate_policy policy = duplicate_policy::sum, std::size_t memory_limit = DefaultMemoryLimit);
+
+        /**
+         * Directory for the sorted runs of unsorted inputs; by default
+         * the one of the output file.
+         */
+        inline void set_temp_directory(std::filesystem::path const &directory)
+        {
+            temp_directory_ = directory;
+        }
+
+        /**
+         * Merge `inputs` into `output`.
+         * @throws std::runtime_error if a file can't be read or written,
+         *         or its size isn't a multiple of `RecordSize`
+         */
+        merge_stats merge(std::vector<std::filesystem::path> const &inputs, std::filesystem::path const &output);
+
+    private:
+        duplicate_policy policy_;
+        std::size_t memory_limit_;
+        std::filesystem::path temp_directory_;
+
+        bool is_sorted(std::filesystem::path const &input, merge_stats &stats) const;
+        std::vector<std::filesystem::path> sort_runs(std::filesystem::path const &input, std::filesystem::path const &prefix, merge_stats &stats) const;
+        void merge_sorted(std::vector<std::filesystem::path> const &sources, std::filesystem::path const &output, merge_stats &stats) const;
+    };
+
+    typedef basic_hash_merger<Sha1Size> hash_merger;
+    typedef basic_hash_merger<NtlmSize> ntlm_hash_merger;
+}
+
+#endif // __HASH_MERGER_HPP__
@@ -0,0 +1,538 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <getopt.hpp>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "block_writer.hpp"
+#include "fast_response_parser.hpp"
+#include "hash_count.hpp"
+#include "radix_sort.hpp"
+#include "range_generator.hpp"
+#include "response_parser.hpp"
+#include "simd.hpp"
+#include "timer.hpp"
+#include "util.hpp"
+
+namespace chrono = std::chrono;
+
+namespace
+{
+    constexpr std::size_t DefaultRangeCount = 4096U;
+    constexpr std::size_t DefaultRounds = 5U;
+
+    struct corpus
+    {
+        std::vector<std::size_t> ranges;
+        std::vector<std::string> bodies;
+        std::size_t bytes{0};
+    };
+
+    hibp::hash_prefix_t make_prefix(std::size_t range)
+    {
+        return hibp::hash_prefix_t{
+            util::nibble2hex(static_cast<std::uint8_t>(range >> 16) & 0xf),
+            util::nibble2hex(static_cast<std::uint8_t>(range >> 12) & 0xf),
+            util::nibble2hex(static_cast<std::uint8_t>(range >> 8) & 0xf),
+            util::nibble2hex(static_cast<std::uint8_t>(range >> 4) & 0xf),
+            util::nibble2hex(static_cast<std::uint8_t>(range) & 0xf)};
+    }
+
+    /**
+     * Ranges as `hibpmock` serves them, i.e. shaped like the API's: CRLF
+     * after every line but the last. With `lf_only` the lines are
+     * separated by a bare LF, which the fast parser doesn't expect.
+     */
+    corpus make_corpus(std::size_t range_count, std::size_t digest_size, bool lf_only)
+    {
+        hibp::range_generator const generate;
+        corpus c;
+        for (std::size_t i = 0; i < range_count; ++i)
+        {
+            // spread the ranges over the whole key space
+            std::size_t const range = (i * 0x9e3779b1U) & 0xfffff;
+            c.ranges.push_back(range);
+            c.bodies.push_back(generate(range, digest_size));
+            if (lf_only)
+            {
+                std::erase(c.bodies.back(), '\r');
+            }
+            c.bytes += c.bodies.back().size();
+        }
+        return c;
+    }
+
+    /**
+     * Parse all bodies of `c` `rounds` times with `Parser` and print the
+     * throughput of the fastest round.
+     * @return the records of the last round, for comparison
+     */
+    template <typename Parser>
+    typename Parser::collection_type run(std::string const &label, corpus const &c, std::size_t rounds)
+    {
+        typename Parser::collection_type all;
+        double best_ns = 0;
+        for (std::size_t round = 0; round < rounds; ++round)
+        {
+            all.clear();
+            util::timer t;
+            if constexpr (std::is_default_constructible_v<Parser>)
+            {
+                // one parser appending to a single collection, like the downloader does
+                Parser parser;
+                for (std::size_t i = 0; i < c.ranges.size(); ++i)
+                {
+                    parser.parse(make_prefix(c.ranges[i]), c.bodies[i], all);
+                }
+            }
+            else
+            {
+                for (std::size_t i = 0; i < c.ranges.size(); ++i)
+                {
+                    Parser parser(make_prefix(c.ranges[i]));
+                    auto const &result = parser.parse(c.bodies[i]);
+                    all.insert(all.end(), result.begin(), result.end());
+                }
+            }
+            double const ns = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(t.elapsed()).count());
+            if (round == 0 || ns < best_ns)
+            {
+                best_ns = ns;
+            }
+        }
+        std::cout << std::left << std::setw(30) << label << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(10) << 1e3 * static_cast<double>(c.bytes) / best_ns << " MB/s"
+                  << std::setw(10) << 1e3 * static_cast<double>(all.size()) / best_ns << " Mrecords/s"
+                  << std::endl;
+        return all;
+    }
+
+    /**
+     * Run `f` `rounds` times and print the time per byte of the fastest round.
+     */
+    template <typename F>
+    void run_hex(std::string const &label, std::size_t bytes, std::size_t rounds, F f)
+    {
+        double best_ns = 0;
+        for (std::size_t round = 0; round < rounds; ++round)
+        {
+            util::timer t;
+            f();
+            double const ns = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(t.elapsed()).count());
+            if (round == 0 || ns < best_ns)
+            {
+                best_ns = ns;
+            }
+        }
+        std::cout << std::left << std::setw(30) << label << std::right
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(10) << best_ns / static_cast<double>(bytes) << " ns/byte"
+                  << std::endl;
+    }
+
+    /**
+     * Time hex decoding and encoding of digests, in bulk and one digest
+     * at a time, and check that all variants agree.
+     */
+    int bench_hex(std::size_t digest_count, std::size_t rounds)
+    {
+        constexpr std::size_t DigestSize = hibp::Sha1Size;
+        std::size_t const bytes = digest_count * DigestSize;
+        std::vector<std::uint8_t> binary(bytes);
+        std::uint64_t state = 0x2545f4914f6cdd1dULL;
+        for (std::uint8_t &b : binary)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            b = static_cast<std::uint8_t>(state >> 56);
+        }
+        std::string text(2 * bytes, '\0');
+        util::hex_encode(binary, text);
+        std::vector<std::uint8_t> decoded(bytes);
+        std::string encoded(2 * bytes, '\0');
+        int rc = EXIT_SUCCESS;
+        auto check = [&](std::string const &label)
+        {
+            if (decoded != binary || encoded != text)
+            {
+                std::cerr << "\u001b[31;1mERROR: " << label << " disagrees with util::hex_encode().\u001b[0m" << std::endl;
+                rc = EXIT_FAILURE;
+            }
+        };
+        run_hex("util::hex_decode", bytes, rounds, [&]
+                { util::hex_decode(text, decoded); });
+        run_hex("util::hex_encode", bytes, rounds, [&]
+                { util::hex_encode(binary, encoded); });
+        check("util");
+        for (hibp::simd::instruction_set isa : {hibp::simd::instruction_set::scalar,
+                                                hibp::simd::instruction_set::sse41,
+                                                hibp::simd::instruction_set::avx2})
+        {
+            hibp::simd::select(isa);
+            if (hibp::simd::selected() != isa)
+            {
+                continue;
+            }
+            std::string const name = hibp::simd::name(isa);
+            std::fill(decoded.begin(), decoded.end(), 0);
+            std::fill(encoded.begin(), encoded.end(), '\0');
+            run_hex("simd::hex_decode/" + name, bytes, rounds, [&]
+                    { hibp::simd::hex_decode(text, decoded); });
+            run_hex("simd::hex_encode/" + name, bytes, rounds, [&]
+                    { hibp::simd::hex_encode(binary, encoded); });
+            check("simd::hex_*/" + name);
+            // one digest at a time, as the parser does
+            std::fill(decoded.begin(), decoded.end(), 0);
+            hibp::simd::kernels const &k = hibp::simd::active();
+            std::string padded = text + std::string(hibp::simd::HexPadding, '0');
+            run_hex("kernels::decode_hex/" + name, bytes, rounds, [&]
+                    {
+                        for (std::size_t i = 0; i < digest_count; ++i)
+                        {
+                            k.decode_hex(padded.data() + 2 * DigestSize * i, decoded.data() + DigestSize * i, DigestSize);
+                        } });
+            check("kernels::decode_hex/" + name);
+        }
+        hibp::simd::select(hibp::simd::detected());
+        return rc;
+    }
+
+    /**
+     * Fill `hashes` with `n` pseudo-random records, the same for the
+     * same `seed`.
+     */
+    void make_random(hibp::collection_t &hashes, std::size_t n, std::uint64_t seed)
+    {
+        hashes.resize(n);
+        std::uint64_t state = seed;
+        for (hibp::hash_count &h : hashes)
+        {
+            for (std::uint8_t &b : h.data)
+            {
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                b = static_cast<std::uint8_t>(state >> 56);
+            }
+            h.count = static_cast<std::uint32_t>(state >> 8);
+        }
+    }
+
+    /**
+     * Order-independent fingerprint of the records, to check that a sort
+     * neither lost nor invented any.
+     */
+    std::uint64_t fingerprint(hibp::collection_t const &hashes)
+    {
+        std::uint64_t sum = 0;
+        for (hibp::hash_count const &h : hashes)
+        {
+            std::uint64_t x = h.count;
+            for (std::uint8_t b : h.data)
+            {
+                x = (x ^ b) * 0x100000001b3ULL;
+            }
+            sum += x;
+        }
+        return sum;
+    }
+
+    /**
+     * Time `std::sort` and `radix_sort()` on `n` random SHA-1 records
+     * each, one run apiece; the same records are generated twice rather
+     * than copied to keep the memory footprint at two collections.
+     */
+    int bench_sort(std::size_t n, std::size_t threads)
+    {
+        hibp::collection_t hashes;
+        make_random(hashes, n, n);
+        std::uint64_t const expected = fingerprint(hashes);
+        util::timer t;
+        std::sort(hashes.begin(), hashes.end(), hibp::smallest_hash_first());
+        double const std_sort = 1e-9 * static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(t.elapsed()).count());
+        make_random(hashes, n, n);
+        t.restart();
+        hibp::radix_sort(hashes, threads);
+        double const radix_sort = 1e-9 * static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(t.elapsed()).count());
+        std::cout << std::setw(14) << n
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(12) << std_sort << " s"
+                  << std::setw(12) << radix_sort << " s"
+                  << std::setprecision(1)
+                  << std::setw(10) << 1e-6 * static_cast<double>(n) / radix_sort << " M/s"
+                  << std::setw(8) << std_sort / radix_sort << "x"
+                  << std::endl;
+        if (!std::is_sorted(hashes.begin(), hashes.end(), hibp::smallest_hash_first()) || fingerprint(hashes) != expected)
+        {
+            std::cerr << "\u001b[31;1mERROR: radix_sort() disagrees with std::sort.\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    /**
+     * Print the throughput of `bytes` in `ns` nanoseconds.
+     */
+    void print_gbps(std::string const &label, std::size_t bytes, double ns)
+    {
+        std::cout << std::left << std::setw(30) << label << std::right
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(10) << static_cast<double>(bytes) / ns << " GB/s"
+                  << std::endl;
+    }
+
+    /**
+     * Write `n` random SHA-1 records to `filename`, record by record
+     * with `hash_count::dump()` and in bulk with `block_writer` for each
+     * instruction set, check that all files are the same, and print the
+     * throughput of each, as well as of the encoding alone.
+     */
+    int bench_write(std::size_t n, std::filesystem::path const &filename)
+    {
+        hibp::collection_t hashes;
+        make_random(hashes, n, n);
+        std::size_t const bytes = n * hibp::block_writer::RecordSize;
+        auto const elapsed_ns = [](util::timer const &t)
+        {
+            return static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(t.elapsed()).count());
+        };
+        std::filesystem::remove(filename);
+        util::timer t;
+        {
+            std::ofstream out(filename, std::ios::binary | std::ios::app);
+            for (hibp::hash_count const &h : hashes)
+            {
+                h.dump(out);
+            }
+        }
+        print_gbps("hash_count::dump", bytes, elapsed_ns(t));
+        std::string expected(bytes, '\0');
+        std::ifstream(filename, std::ios::binary).read(expected.data(), static_cast<std::streamsize>(bytes));
+        int rc = EXIT_SUCCESS;
+        std::vector<std::uint8_t> encoded(bytes);
+        for (hibp::simd::instruction_set isa : {hibp::simd::instruction_set::scalar,
+                                                hibp::simd::instruction_set::sse41,
+                                                hibp::simd::instruction_set::avx2})
+        {
+            hibp::simd::select(isa);
+            if (hibp::simd::selected() != isa)
+            {
+                continue;
+            }
+            std::string const name = hibp::simd::name(isa);
+            t.restart();
+            hibp::block_writer::encode(hashes.data(), n, encoded.data());
+            print_gbps("block_writer::encode/" + name, bytes, elapsed_ns(t));
+            std::filesystem::remove(filename);
+            t.restart();
+            {
+                hibp::block_writer out(filename);
+                out.write(hashes);
+            }
+            print_gbps("block_writer::write/" + name, bytes, elapsed_ns(t));
+            std::string actual(bytes, '\0');
+            std::ifstream(filename, std::ios::binary).read(actual.data(), static_cast<std::streamsize>(bytes));
+            if (actual != expected || std::memcmp(encoded.data(), expected.data(), bytes) != 0)
+            {
+                std::cerr << "\u001b[31;1mERROR: block_writer/" << name << " disagrees with hash_count::dump().\u001b[0m" << std::endl;
+                rc = EXIT_FAILURE;
+            }
+        }
+        hibp::simd::select(hibp::simd::detected());
+        std::filesystem::remove(filename);
+        return rc;
+    }
+
+    /**
+     * Parse a record count like `10M` or `1G`.
+     */
+    std::size_t parse_count(std::string const &arg)
+    {
+        std::size_t pos = 0;
+        std::size_t n = std::stoul(arg, &pos);
+        switch (pos < arg.size() ? arg[pos] : '\0')
+        {
+        case 'k':
+        case 'K':
+            return n * 1'000;
+        case 'M':
+            return n * 1'000'000;
+        case 'G':
+            return n * 1'000'000'000;
+        default:
+            return n;
+        }
+    }
+
+    template <std::size_t DigestSize>
+    int bench_parsers(corpus const &c, std::size_t rounds)
+    {
+        using reference_parser = hibp::basic_response_parser<DigestSize>;
+        using fast_parser = hibp::basic_fast_response_parser<DigestSize>;
+        auto const expected = run<reference_parser>("response_parser", c, rounds);
+        int rc = EXIT_SUCCESS;
+        for (hibp::simd::instruction_set isa : {hibp::simd::instruction_set::scalar,
+                                                hibp::simd::instruction_set::sse41,
+                                                hibp::simd::instruction_set::avx2})
+        {
+            hibp::simd::select(isa);
+            if (hibp::simd::selected() != isa)
+            {
+                continue;
+            }
+            auto const actual = run<fast_parser>(std::string("fast_response_parser/") + hibp::simd::name(isa), c, rounds);
+            bool const same = actual.size() == expected.size() &&
+                              std::equal(actual.begin(), actual.end(), expected.begin(), [](auto const &a, auto const &b)
+                                         { return a.data == b.data && a.count == b.count; });
+            if (!same)
+            {
+                std::cerr << "\u001b[31;1mERROR: results differ from response_parser.\u001b[0m" << std::endl;
+                rc = EXIT_FAILURE;
+            }
+        }
+        hibp::simd::select(hibp::simd::detected());
+        return rc;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::size_t range_count{DefaultRangeCount};
+    std::size_t rounds{DefaultRounds};
+    std::string mode{"sha1"};
+    bool lf_only{false};
+    bool hex{false};
+    std::vector<std::size_t> sort_sizes;
+    std::size_t threads{std::max(1U, std::thread::hardware_concurrency())};
+    std::size_t write_size{0};
+    std::filesystem::path write_filename{std::filesystem::temp_directory_path() / "hibpbench.bin"};
+
+    using argparser = argparser::argparser;
+    argparser opt(argc, argv);
+    opt.reg({"-n", "--ranges"}, argparser::required_argument,
+            [&range_count](std::string const &arg)
+            {
+                range_count = std::max<std::size_t>(1, std::stoul(arg));
+            });
+    opt.reg({"-r", "--rounds"}, argparser::required_argument,
+            [&rounds](std::string const &arg)
+            {
+                rounds = std::max<std::size_t>(1, std::stoul(arg));
+            });
+    opt.reg({"-m", "--mode"}, argparser::required_argument,
+            [&mode](std::string const &arg)
+            {
+                mode = arg;
+            });
+    opt.reg({"-l", "--lf"}, argparser::no_argument,
+            [&lf_only](std::string const &)
+            {
+                lf_only = true;
+            });
+    opt.reg({"-x", "--hex"}, argparser::no_argument,
+            [&hex](std::string const &)
+            {
+                hex = true;
+            });
+    opt.reg({"-s", "--sort"}, argparser::required_argument,
+            [&sort_sizes](std::string const &arg)
+            {
+                std::size_t begin = 0;
+                while (begin < arg.size())
+                {
+                    std::size_t const end = std::min(arg.find(',', begin), arg.size());
+                    sort_sizes.push_back(parse_count(arg.substr(begin, end - begin)));
+                    begin = end + 1;
+                }
+            });
+    opt.reg({"-j", "--threads"}, argparser::required_argument,
+            [&threads](std::string const &arg)
+            {
+                threads = std::max<std::size_t>(1, std::stoul(arg));
+            });
+    opt.reg({"-w", "--write"}, argparser::required_argument,
+            [&write_size](std::string const &arg)
+            {
+                write_size = parse_count(arg);
+            });
+    opt.reg({"-o", "--output"}, argparser::required_argument,
+            [&write_filename](std::string const &arg)
+            {
+                write_filename = arg;
+            });
+    opt.reg({"-?", "--help"}, argparser::no_argument,
+            [](std::string const &)
+            {
+                std::cout << "USAGE: hibpbench [-n RANGES] [-r ROUNDS] [-m sha1|ntlm] [-l] [-x] [-s N,... [-j THREADS]] [-w N [-o FILE]]\n"
+                             "  -l  separate lines with LF instead of CRLF\n"
+                             "  -x  benchmark the hex primitives instead of the parsers\n"
+                             "  -s  sort N random records with std::sort and radix_sort() instead,\n"
+                             "      e.g. `-s 10M,100M,1G`; needs 2 x 24 bytes per record\n"
+                             "  -j  number of threads for radix_sort() (default: all cores)\n"
+                             "  -w  write N random records with hash_count::dump() and block_writer instead\n"
+                             "  -o  file to write them to (default: hibpbench.bin in the temp directory)\n";
+                exit(EXIT_SUCCESS);
+            });
+    try
+    {
+        opt();
+    }
+    catch (::argparser::argument_required_exception const &e)
+    {
+        std::cerr << e.what() << '\n';
+    }
+
+    if (!sort_sizes.empty())
+    {
+        std::cout << "Sorting SHA-1 records, radix_sort() on " << threads << " threads\n\n"
+                  << std::setw(14) << "records" << std::setw(14) << "std::sort" << std::setw(14) << "radix_sort"
+                  << std::setw(14) << "" << std::setw(9) << "speedup" << std::endl;
+        int rc = EXIT_SUCCESS;
+        for (std::size_t n : sort_sizes)
+        {
+            if (bench_sort(n, threads) != EXIT_SUCCESS)
+            {
+                rc = EXIT_FAILURE;
+            }
+        }
+        return rc;
+    }
+
+    if (write_size > 0)
+    {
+        std::cout << "Writing " << write_size << " SHA-1 records, "
+                  << write_size * hibp::block_writer::RecordSize / (1024 * 1024) << " MB, to "
+                  << write_filename.string() << "\n\n";
+        return bench_write(write_size, write_filename);
+    }
+
+    if (hex)
+    {
+        // about as many digests as RANGES ranges hold
+        std::size_t const digests = range_count * 800;
+        std::cout << "Converting " << digests << " SHA-1 digests, best of " << rounds << " rounds; CPU supports "
+                  << hibp::simd::name(hibp::simd::detected()) << "\n\n";
+        return bench_hex(digests, rounds);
+    }
+
+    bool const ntlm = mode == "ntlm";
+    corpus const c = make_corpus(range_count, ntlm ? hibp::NtlmSize : hibp::Sha1Size, lf_only);
+    std::cout << "Parsing " << c.ranges.size() << " synthetic " << (ntlm ? "NTLM" : "SHA-1") << " ranges"
+              << (lf_only ? " with LF line endings, " : ", ")
+              << c.bytes / 1024 << " KB, best of " << rounds << " rounds; CPU supports "
+              << hibp::simd::name(hibp::simd::detected()) << "\n\n";
+    return ntlm
+               ? bench_parsers<hibp::NtlmSize>(c, rounds)
+               : bench_parsers<hibp::Sha1Size>(c, rounds);
+}
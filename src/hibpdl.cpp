@@ -5,13 +5,18 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <sstream>
-#include <queue>
 #include <iostream>
 #include <iomanip>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
 
-#include "response_parser.hpp"
+#include "fast_response_parser.hpp"
 #include "hibpdl.hpp"
+#include "inflater.hpp"
+#include "timer.hpp"
 #include "util.hpp"
 
 namespace hibp
@@ -34,88 +39,504 @@ namespace hibp
             return "Unknown";
 #endif
         }
+
+        hash_prefix_t make_prefix(std::size_t range)
+        {
+            return hash_prefix_t{
+                ::util::nibble2hex(static_cast<std::uint8_t>(range >> 16) & 0xf),
+                ::util::nibble2hex(static_cast<std::uint8_t>(range >> 12) & 0xf),
+                ::util::nibble2hex(static_cast<std::uint8_t>(range >> 8) & 0xf),
+                ::util::nibble2hex(static_cast<std::uint8_t>(range >> 4) & 0xf),
+                ::util::nibble2hex(static_cast<std::uint8_t>(range) & 0xf)};
+        }
+
+        /**
+         * Turns a response body into records: inflates it if it's
+         * gzip-encoded and hands the result to the parser, both as the
+         * body comes in.
+         */
+        template <std::size_t DigestSize>
+        class body_decoder final
+        {
+        public:
+            body_decoder()
+                : to_parser_([this](std::string_view data)
+                             { parser_.feed(data); })
+            {
+            }
+            body_decoder(body_decoder const &) = delete;
+            body_decoder &operator=(body_decoder const &) = delete;
+
+            /**
+             * Get ready for the response for `prefix`, whose records are
+             * to be appended to `out`.
+             */
+            void begin(hash_prefix_t const &prefix, basic_collection<DigestSize> &out)
+            {
+                parser_.begin(prefix, out);
+                inflater_.reset();
+                started_ = false;
+                gzip_ = false;
+                failed_ = false;
+                body_bytes_ = 0;
+            }
+
+            /**
+             * Tell the decoder the `Content-Encoding` of the body before
+             * feeding the first piece of it.
+             */
+            void start(std::string_view content_encoding)
+            {
+                started_ = true;
+                gzip_ = content_encoding == "gzip";
+                // nothing but gzip has been asked for
+                failed_ = !gzip_ && !content_encoding.empty() && content_encoding != "identity";
+            }
+
+            inline bool started() const
+            {
+                return started_;
+            }
+
+            void feed(std::string_view data)
+            {
+                body_bytes_ += data.size();
+                if (failed_)
+                {
+                    return;
+                }
+                if (gzip_)
+                {
+                    failed_ = !inflater_.feed(data, to_parser_);
+                }
+                else
+                {
+                    parser_.feed(data);
+                }
+            }
+
+            /**
+             * Complete the body and add its sizes and the time spent
+             * inflating it to `stats`.
+             * @return `false` if the body turned out to be malformed
+             */
+            bool finish(download_stats &stats)
+            {
+                if (gzip_ && !failed_)
+                {
+                    failed_ = !inflater_.finish(to_parser_);
+                }
+                stats.body_bytes += body_bytes_;
+                if (gzip_)
+                {
+                    stats.compressed_bytes += inflater_.bytes_in();
+                    stats.inflated_bytes += inflater_.bytes_out();
+                    stats.inflate_ns += inflater_.inflate_ns();
+                }
+                if (!parser_.finish() || failed_)
+                {
+                    parser_.discard();
+                    return false;
+                }
+                return true;
+            }
+
+            void discard()
+            {
+                parser_.discard();
+            }
+
+            inline std::size_t written() const
+            {
+                return parser_.written();
+            }
+
+            /** time spent inflating the current body */
+            inline std::uint64_t inflate_ns() const
+            {
+                return inflater_.inflate_ns();
+            }
+
+        private:
+            basic_fast_response_parser<DigestSize> parser_;
+            inflater inflater_;
+            inflater::sink const to_parser_;
+            bool started_{false};
+            bool gzip_{false};
+            bool failed_{false};
+            std::uint64_t body_bytes_{0};
+        };
     }
-    const std::string downloader::DefaultUserAgent =
+    template <std::size_t DigestSize>
+    const std::string basic_downloader<DigestSize>::DefaultUserAgent =
         std::string(PROJECT_NAME) + "/" + PROJECT_VERSION + " (" + get_os_name() + ") cpp-httplib";
-    const std::string downloader::ApiUrl = "https://api.pwnedpasswords.com";
-    constexpr std::size_t MaxHashesInDownload = 2'000;
+    template <std::size_t DigestSize>
+    const std::string basic_downloader<DigestSize>::DefaultApiUrl = "https://api.pwnedpasswords.com";
 
-    downloader::downloader(
+    template <std::size_t DigestSize>
+    basic_downloader<DigestSize>::basic_downloader(
         std::size_t first_prefix,
         std::size_t last_prefix,
+        std::size_t prefix_step,
+        std::size_t num_workers,
         std::size_t max_hash_count)
+        : first_prefix_(first_prefix), last_prefix_(last_prefix), prefix_step_(prefix_step),
+          ranges_per_batch_(prefix_step * RangesPerPrefix),
+          num_workers_(std::max<std::size_t>(1, std::min(num_workers, (last_prefix - first_prefix) * RangesPerPrefix))),
+          max_hash_count_(max_hash_count),
+          dispenser_(first_prefix * RangesPerPrefix, last_prefix * RangesPerPrefix),
+          batches_((last_prefix - first_prefix + prefix_step - 1) / prefix_step)
     {
-        collection_.reserve(max_hash_count);
-        for (std::size_t i = first_prefix; i < last_prefix; ++i)
+        assert(prefix_step_ > 0);
+        for (std::size_t i = 0; i < batches_.size(); ++i)
         {
-            hash_prefix_t p{
-                ::util::nibble2hex(static_cast<std::uint8_t>(i >> 12) & 0xf),
-                ::util::nibble2hex(static_cast<std::uint8_t>(i >> 8) & 0xf),
-                ::util::nibble2hex(static_cast<std::uint8_t>(i >> 4) & 0xf),
-                ::util::nibble2hex(static_cast<std::uint8_t>(i) & 0xf),
-                0};
-            hash_queue_.emplace(p);
+            std::size_t const first = first_prefix + i * prefix_step;
+            batches_[i].pending = (std::min(first + prefix_step, last_prefix) - first) * RangesPerPrefix;
+            batches_[i].slots.resize(batches_[i].pending);
         }
+        collection_.reserve(max_hash_count_);
     };
 
-    void downloader::log(std::string const &message)
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::log(std::string const &message)
     {
         const std::lock_guard<std::mutex> lock(output_mutex_);
         std::cout << message << std::endl;
     }
 
-    void downloader::warning(std::string const &message)
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::warning(std::string const &message)
     {
         const std::lock_guard<std::mutex> lock(output_mutex_);
         std::cout << message << std::endl;
     }
 
-    void downloader::error(std::string const &message)
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::error(std::string const &message)
     {
         const std::lock_guard<std::mutex> lock(output_mutex_);
         std::cerr << message << std::endl;
     }
 
-    void downloader::stop()
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::stop()
     {
         do_quit_.store(true);
+        {
+            std::lock_guard<std::mutex> lock(window_mutex_);
+            window_cv_.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(batch_mutex_);
+            batch_cv_.notify_all();
+        }
     }
 
-    void downloader::http_worker()
+    template <std::size_t DigestSize>
+    bool basic_downloader<DigestSize>::next_batch()
     {
-        httplib::Client cli(ApiUrl);
-        cli.set_compress(true);
+        std::size_t const idx = batches_delivered_.load();
+        if (idx >= batches_.size())
+        {
+            return false;
+        }
+        {
+            std::unique_lock<std::mutex> lock(batch_mutex_);
+            batch_cv_.wait(lock, [this, idx]
+                           { return do_quit_.load() || batches_[idx].pending.load() == 0; });
+        }
+        if (do_quit_.load())
+        {
+            return false;
+        }
+        current_batch_ = idx;
+        std::size_t const first = first_prefix_ + idx * prefix_step_;
+        batch_range_ = std::make_pair(first, std::min(first + prefix_step_, last_prefix_));
+        {
+            std::lock_guard<std::mutex> window_lock(window_mutex_);
+            ++batches_delivered_;
+        }
+        window_cv_.notify_all();
+        return true;
+    }
+
+    template <std::size_t DigestSize>
+    std::size_t basic_downloader<DigestSize>::batch_hash_count() const
+    {
+        std::size_t n = 0;
+        for (collection_type const &slot : batches_[current_batch_].slots)
+        {
+            n += slot.size();
+        }
+        return n;
+    }
+
+    template <std::size_t DigestSize>
+    typename basic_downloader<DigestSize>::collection_type const &basic_downloader<DigestSize>::finalize()
+    {
+        // All workers are done with the current batch, so its
+        // slots can be stitched together without holding a lock.
+        collection_.clear();
+        collection_.reserve(batch_hash_count());
+        for (collection_type &slot : batches_[current_batch_].slots)
+        {
+            // the API sends each range in order, but don't rely on a
+            // server to do so
+            if (!std::is_sorted(slot.begin(), slot.end(), smallest_hash_first()))
+            {
+                std::sort(slot.begin(), slot.end(), smallest_hash_first());
+            }
+            collection_.insert(collection_.end(), slot.begin(), slot.end());
+            collection_type{}.swap(slot);
+        }
+        return collection_;
+    }
+
+    template <std::size_t DigestSize>
+    std::size_t basic_downloader<DigestSize>::batch_of(std::size_t range) const
+    {
+        return (range - dispenser_.first()) / ranges_per_batch_;
+    }
+
+    template <std::size_t DigestSize>
+    bool basic_downloader<DigestSize>::within_window(std::size_t range) const
+    {
+        return batch_of(range) < batches_delivered_.load() + MaxBatchesAhead;
+    }
+
+    template <std::size_t DigestSize>
+    typename basic_downloader<DigestSize>::collection_type &basic_downloader<DigestSize>::slot_of(std::size_t range)
+    {
+        collection_type &hashes = batches_[batch_of(range)].slots[(range - dispenser_.first()) % ranges_per_batch_];
+        if (hashes.capacity() == 0)
+        {
+            hashes.reserve(max_hash_count_ / ranges_per_batch_);
+        }
+        return hashes;
+    }
+
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::store(std::size_t range, std::size_t n)
+    {
+        hashes_collected_.fetch_add(n, std::memory_order_relaxed);
+        if (verbosity_ > 0)
+        {
+            std::ostringstream ss;
+            ss << make_prefix(range) << ": " << std::dec << n << " hashes";
+            log(ss.str());
+        }
+        finish(range);
+        if (verbosity_ > 0)
+        {
+            std::ostringstream ss;
+            ss << "\u001b[32;1mTotal hashes collected: "
+               << hashes_collected_.load(std::memory_order_relaxed)
+               << "\u001b[0m";
+            log(ss.str());
+        }
+    }
+
+    template <std::size_t DigestSize>
+    bool basic_downloader<DigestSize>::conditional(std::size_t range) const
+    {
+        return previous_output_ && previous_validators_->known(range);
+    }
+
+    /**
+     * Copy `range`, which has been requested conditionally and answered
+     * with 304 Not Modified, from the previous output.
+     * @return `false` if it isn't there after all; the range's validators
+     *         are forgotten then, so that it's requested unconditionally
+     *         next time.
+     */
+    template <std::size_t DigestSize>
+    bool basic_downloader<DigestSize>::store_unmodified(std::size_t range, std::string const &etag, std::string const &last_modified)
+    {
+        long const n = previous_output_->read(range, slot_of(range));
+        if (n == 0)
+        {
+            // every range of the dataset has records
+            previous_validators_->forget(range, range + 1);
+            if (verbosity_ > 0)
+            {
+                std::ostringstream ss;
+                ss << "\u001b[33mWARNING: range " << make_prefix(range)
+                   << " is unchanged, but missing from the previous output; downloading it again\u001b[0m";
+                warning(ss.str());
+            }
+            return false;
+        }
+        if (etag.empty() && last_modified.empty())
+        {
+            validators_.copy(range, *previous_validators_);
+        }
+        else
+        {
+            validators_.set(range, etag, last_modified);
+        }
+        hashes_collected_.fetch_add(static_cast<std::size_t>(n), std::memory_order_relaxed);
+        ++stats_.not_modified;
+        finish(range);
+        return true;
+    }
+
+    template <std::size_t DigestSize>
+    std::vector<std::pair<std::string, std::string>> basic_downloader<DigestSize>::request_headers(std::size_t range, bool compress) const
+    {
+        std::vector<std::pair<std::string, std::string>> headers;
+        if (compress)
+        {
+            headers.emplace_back("Accept-Encoding", "gzip");
+        }
+        if (!conditional(range))
+        {
+            return headers;
+        }
+        if (!previous_validators_->etag(range).empty())
+        {
+            headers.emplace_back("If-None-Match", previous_validators_->etag(range));
+        }
+        else
+        {
+            headers.emplace_back("If-Modified-Since", util::format_http_date(previous_validators_->last_modified(range)));
+        }
+        return headers;
+    }
+
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::rate_compression(bool compressed, std::uint64_t inflate_ns, std::size_t hashes)
+    {
+        std::optional<std::string> const reasoning = compression_.record(compressed, inflate_ns, hashes);
+        if (reasoning.has_value() && verbosity_ > 0)
+        {
+            log(*reasoning);
+        }
+    }
+
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::refresh_from(std::filesystem::path const &previous_output, std::filesystem::path const &previous_validators)
+    {
+        auto validators = std::make_unique<etag_store>();
+        if (!validators->load(previous_validators))
+        {
+            throw std::runtime_error("cannot read " + previous_validators.string());
+        }
+        previous_output_ = std::make_unique<basic_range_archive<DigestSize>>(previous_output);
+        previous_validators_ = std::move(validators);
+    }
+
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::finish(std::size_t range)
+    {
+        if (batches_[batch_of(range)].pending.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(batch_mutex_);
+            batch_cv_.notify_all();
+        }
+    }
+
+    template <std::size_t DigestSize>
+    std::optional<std::chrono::milliseconds> basic_downloader<DigestSize>::after_failure(
+        std::size_t range,
+        std::size_t failures,
+        bool transient,
+        std::optional<std::chrono::milliseconds> retry_after,
+        std::string const &reason,
+        std::mt19937 &rng)
+    {
+        hash_prefix_t const prefix = make_prefix(range);
+        if (!transient || failures >= retry_policy_.max_attempts)
+        {
+            {
+                std::lock_guard<std::mutex> lock(failed_mutex_);
+                failed_ranges_.push_back(range);
+            }
+            // before `finish()` hands the batch out
+            ++batches_[batch_of(range)].failed;
+            ++stats_.failed;
+            std::ostringstream ss;
+            ss << "\u001b[31;1mERROR: giving up on range " << prefix
+               << " after " << std::dec << failures << " attempt(s): "
+               << reason << "\u001b[0m";
+            error(ss.str());
+            finish(range);
+            return std::nullopt;
+        }
+        ++stats_.retries;
+        std::chrono::milliseconds const delay = retry_policy_.delay(failures, retry_after, rng);
+        std::ostringstream ss;
+        ss << "\u001b[33mWARNING: range " << prefix << ": " << reason
+           << "; retrying in " << std::dec << delay.count() << " ms"
+           << " (attempt " << (failures + 1) << " of " << retry_policy_.max_attempts << ")\u001b[0m";
+        warning(ss.str());
+        return delay;
+    }
+
+    template <std::size_t DigestSize>
+    bool basic_downloader<DigestSize>::pause(std::chrono::milliseconds delay)
+    {
+        std::unique_lock<std::mutex> lock(window_mutex_);
+        return !window_cv_.wait_for(lock, delay, [this]
+                                    { return do_quit_.load(); });
+    }
+
+    template <std::size_t DigestSize>
+    std::vector<std::size_t> basic_downloader<DigestSize>::failed_ranges() const
+    {
+        std::lock_guard<std::mutex> lock(failed_mutex_);
+        std::vector<std::size_t> ranges = failed_ranges_;
+        std::sort(ranges.begin(), ranges.end());
+        return ranges;
+    }
+
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::http_worker(std::size_t worker_id)
+    {
+        httplib::Client cli(api_url_);
+        // compressed bodies are inflated by `body_decoder`, as they stream in
+        cli.set_decompress(false);
+        cli.set_keep_alive(true);
         httplib::Headers headers{
             {"User-Agent", DefaultUserAgent}};
         cli.set_default_headers(headers);
+        bool const use_tls = api_url_.rfind("https://", 0) == 0;
+        bool had_connection = false;
+        std::mt19937 rng{std::random_device{}() ^ static_cast<std::uint32_t>(worker_id)};
+        // appends the records straight to the range's slot in its batch
+        body_decoder<DigestSize> decoder;
 
         while (!do_quit_.load())
         {
-            hash_prefix_t prefix;
+            std::size_t range;
+            if (!dispenser_.take(range))
             {
-                std::lock_guard<std::mutex> lock(queue_mutex_);
-                if (hash_queue_.empty())
+                if (verbosity_ > 2)
                 {
-                    if (verbosity_ > 2)
-                    {
-                        std::ostringstream os;
-                        os << "Queue is empty; thread ID "
-                           << std::this_thread::get_id()
-                           << " ..." << std::endl;
-                        log(os.str());
-                    }
-                    return;
+                    std::ostringstream os;
+                    os << "No ranges left; thread ID "
+                       << std::this_thread::get_id()
+                       << " ..." << std::endl;
+                    log(os.str());
                 }
-                else
+                return;
+            }
+            if (!within_window(range))
+            {
+                // don't run too far ahead of the batches already handed out
+                std::unique_lock<std::mutex> lock(window_mutex_);
+                window_cv_.wait(lock, [this, range]
+                                { return do_quit_.load() || within_window(range); });
+                if (do_quit_.load())
                 {
-                    prefix = hash_queue_.front();
-                    hash_queue_.pop();
+                    break;
                 }
             }
-            collection_t hashes;
-            hashes.reserve(MaxHashesInDownload);
-            std::size_t nibble = 0x0;
-            while (nibble <= 0xf)
+            hash_prefix_t const prefix = make_prefix(range);
+            std::string const path = "/range/" + std::string(prefix.begin(), prefix.end()) + mode_query<DigestSize>();
+            bool const compress = compression_.compress();
+            std::size_t failures = 0;
+            bool done = false;
+            while (!done)
             {
                 if (do_quit_.load())
                 {
@@ -129,54 +550,269 @@ namespace hibp
                     }
                     return;
                 }
-                prefix[4] = ::util::nibble2hex(static_cast<std::uint8_t>(nibble));
-                std::string const hash_prefix(prefix.begin(), prefix.end());
-                std::string const path = "/range/" + hash_prefix;
-                if (httplib::Result res = cli.Get(path.c_str()))
+                bool const reused = cli.is_socket_open();
+                if (reused)
+                {
+                    ++stats_.reused;
+                }
+                else
                 {
-                    std::ostringstream ss;
-                    if (res->status == 200)
+                    ++stats_.connects;
+                    if (had_connection)
                     {
-                        response_parser parser(prefix);
-                        collection_t const &result = parser.parse(res->body);
-                        auto const &h = result.front();
-                        ss << h.data << ':' << std::dec << h.count;
-                        hashes.insert(hashes.end(), result.begin(), result.end());
-                        ++nibble;
-                        if (verbosity_ > 0)
+                        ++stats_.reconnects;
+                    }
+                    if (use_tls)
+                    {
+                        // cpp-httplib doesn't resume TLS sessions
+                        ++stats_.handshakes;
+                    }
+                    had_connection = true;
+                }
+                httplib::Headers range_headers;
+                for (auto const &[name, value] : request_headers(range, compress))
+                {
+                    range_headers.emplace(name, value);
+                }
+                util::timer t;
+                // parse the body as it comes in instead of buffering it
+                int status = 0;
+                decoder.begin(prefix, slot_of(range));
+                httplib::Result res = cli.Get(
+                    path, range_headers,
+                    [&status, &decoder](httplib::Response const &response)
+                    {
+                        status = response.status;
+                        decoder.start(response.get_header_value("Content-Encoding"));
+                        return true;
+                    },
+                    [&status, &decoder](char const *data, std::size_t length)
+                    {
+                        if (status == 200)
                         {
-                            log(ss.str());
+                            decoder.feed(std::string_view(data, length));
                         }
-                    }
-                    else
+                        return true;
+                    });
+                ++stats_.requests;
+                stats_.request_ns += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.elapsed()).count());
+                if (res && res->status == 200 && decoder.finish(stats_))
+                {
+                    rate_compression(compress, decoder.inflate_ns(), decoder.written());
+                    validators_.set(range, res->get_header_value("ETag"), res->get_header_value("Last-Modified"));
+                    store(range, decoder.written());
+                    done = true;
+                    continue;
+                }
+                decoder.discard();
+                if (res && res->status == 304 && conditional(range))
+                {
+                    // if the range isn't in the previous output, the next
+                    // attempt asks for it unconditionally
+                    done = store_unmodified(range, res->get_header_value("ETag"), res->get_header_value("Last-Modified"));
+                    continue;
+                }
+                std::optional<std::chrono::milliseconds> delay;
+                if (res && res->status == 200)
+                {
+                    delay = after_failure(range, ++failures, true, std::nullopt, "malformed response", rng);
+                }
+                else if (res)
+                {
+                    delay = after_failure(range, ++failures, retry_policy::is_transient(res->status),
+                                          retry_policy::parse_retry_after(res->get_header_value("Retry-After")),
+                                          "HTTP status code " + std::to_string(res->status), rng);
+                }
+                else
+                {
+                    delay = after_failure(range, ++failures, true, std::nullopt, httplib::to_string(res.error()), rng);
+                }
+                if (!delay.has_value())
+                {
+                    done = true;
+                }
+                else if (!pause(*delay))
+                {
+                    return;
+                }
+            }
+        }
+        if (verbosity_ > 2)
+        {
+            std::ostringstream os;
+            os << "http_worker() with thread ID "
+               << std::this_thread::get_id()
+               << " ..." << std::endl;
+            log(os.str());
+        }
+    }
+
+#if defined(__linux__)
+    template <std::size_t DigestSize>
+    void basic_downloader<DigestSize>::event_worker(std::size_t worker_id, std::size_t connections)
+    {
+        using clock = std::chrono::steady_clock;
+        struct retry
+        {
+            clock::time_point due;
+            std::size_t range;
+        };
+        // ranges whose download failed and have to be requested again
+        std::vector<retry> retries;
+        // number of failed attempts per range
+        std::unordered_map<std::size_t, std::size_t> failures;
+        // one parser per request in flight, fed as the bodies come in and
+        // reused for the following requests
+        struct stream
+        {
+            std::size_t range{0};
+            bool busy{false};
+            bool compress{false};
+            body_decoder<DigestSize> decoder;
+        };
+        std::vector<stream> streams(std::max<std::size_t>(1, connections));
+        auto stream_of = [&streams](std::size_t range) -> stream &
+        {
+            auto const it = std::find_if(streams.begin(), streams.end(), [range](stream const &s)
+                                         { return s.busy && s.range == range; });
+            assert(it != streams.end());
+            return *it;
+        };
+        // range taken from the dispenser, but not yet inside the batch window
+        std::size_t held_range = 0;
+        bool holding = false;
+        std::mt19937 rng{std::random_device{}() ^ static_cast<std::uint32_t>(worker_id)};
+        auto next = [&](event_client::request &req)
+        {
+            std::size_t range;
+            auto const due = std::min_element(retries.begin(), retries.end(), [](retry const &a, retry const &b)
+                                              { return a.due < b.due; });
+            if (due != retries.end() && due->due <= clock::now())
+            {
+                range = due->range;
+                retries.erase(due);
+            }
+            else
+            {
+                if (!holding)
+                {
+                    if (!dispenser_.take(held_range))
                     {
-                        ss << "\u001b[31;WARNING: HTTP status code = "
-                           << res->status
-                           << "\u001b[0m";
-                        error(ss.str());
+                        return retries.empty()
+                                   ? event_client::next_request::done
+                                   : event_client::next_request::wait;
                     }
+                    holding = true;
                 }
+                if (!within_window(held_range))
+                {
+                    return event_client::next_request::wait;
+                }
+                range = held_range;
+                holding = false;
             }
-            std::ostringstream ss;
+            hash_prefix_t const prefix = make_prefix(range);
+            req.id = range;
+            req.path = "/range/" + std::string(prefix.begin(), prefix.end()) + mode_query<DigestSize>();
+            stream &idle = *std::find_if(streams.begin(), streams.end(), [](stream const &s)
+                                         { return !s.busy; });
+            idle.compress = compression_.compress();
+            req.headers = request_headers(range, idle.compress);
+            idle.range = range;
+            idle.busy = true;
+            idle.decoder.begin(prefix, slot_of(range));
+            return event_client::next_request::ok;
+        };
+        auto retry_later = [&](std::size_t range, bool transient, std::optional<std::chrono::milliseconds> retry_after, std::string const &reason)
+        {
+            std::size_t const n = ++failures[range];
+            std::optional<std::chrono::milliseconds> const delay = after_failure(range, n, transient, retry_after, reason, rng);
+            if (delay.has_value())
             {
-                std::lock_guard<std::mutex> lock(collection_mutex_);
-                collection_.insert(collection_.end(), hashes.begin(), hashes.end());
-                if (verbosity_ > 0)
+                retries.push_back(retry{clock::now() + *delay, range});
+            }
+            else
+            {
+                failures.erase(range);
+            }
+        };
+        auto on_body = [&](event_client::request const &req, http_response const &res, std::string_view data)
+        {
+            if (res.status == 200)
+            {
+                body_decoder<DigestSize> &decoder = stream_of(req.id).decoder;
+                if (!decoder.started())
                 {
-                    ss << "\u001b[32;1mTotal hashes collected: "
-                       << collection_.size()
-                       << "\u001b[0m";
-                    log(ss.str());
+                    decoder.start(res.header("Content-Encoding"));
+                }
+                decoder.feed(data);
+            }
+        };
+        auto on_response = [&](event_client::request const &req, http_response &res)
+        {
+            stream &s = stream_of(req.id);
+            s.busy = false;
+            if (res.status == 200)
+            {
+                if (!s.decoder.finish(stats_))
+                {
+                    retry_later(req.id, true, std::nullopt, "malformed response");
+                    return;
                 }
+                rate_compression(s.compress, s.decoder.inflate_ns(), s.decoder.written());
+                failures.erase(req.id);
+                validators_.set(req.id, res.header("ETag"), res.header("Last-Modified"));
+                store(req.id, s.decoder.written());
+                return;
             }
+            if (res.status == 304 && conditional(req.id))
+            {
+                if (store_unmodified(req.id, res.header("ETag"), res.header("Last-Modified")))
+                {
+                    failures.erase(req.id);
+                }
+                else
+                {
+                    // not in the previous output; ask again unconditionally
+                    retries.push_back(retry{clock::now(), req.id});
+                }
+                return;
+            }
+            retry_later(req.id, retry_policy::is_transient(res.status),
+                        retry_policy::parse_retry_after(res.header("Retry-After")),
+                        "HTTP status code " + std::to_string(res.status));
+        };
+        auto on_error = [&](event_client::request const &req, std::string const &message)
+        {
+            stream &s = stream_of(req.id);
+            s.decoder.discard();
+            s.busy = false;
+            retry_later(req.id, true, std::nullopt, message);
+        };
+        try
+        {
+            event_client cli(api_url_, connections);
+            cli.set_user_agent(DefaultUserAgent);
+            cli.set_stats(&stats_);
+            cli.set_body_sink(on_body);
+            cli.run(next, on_response, on_error, do_quit_);
+        }
+        catch (std::exception const &e)
+        {
+            error(std::string("\u001b[31;1mERROR: ") + e.what() + "\u001b[0m");
+            stop();
         }
         if (verbosity_ > 2)
         {
             std::ostringstream os;
-            os << "http_worker() with thread ID "
+            os << "event_worker() with thread ID "
                << std::this_thread::get_id()
                << " ..." << std::endl;
             log(os.str());
         }
     }
+#endif
+
+    template class basic_downloader<Sha1Size>;
+    template class basic_downloader<NtlmSize>;
 }
@@ -9,14 +9,20 @@
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <cassert>
+#include <condition_variable>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <random>
 #include <string>
 #include <string_view>
-#include <queue>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifndef CPPHTTPLIB_OPENSSL_SUPPORT
@@ -24,67 +30,281 @@
 #endif
 #include <httplib.h>
 
+#include "download_stats.hpp"
+#include "etag_store.hpp"
+#include "event_client.hpp"
+#include "compression_advisor.hpp"
 #include "hash_count.hpp"
+#include "inflater.hpp"
+#include "range_archive.hpp"
+#include "range_dispenser.hpp"
 #include "response_parser.hpp"
+#include "retry_policy.hpp"
 #include "util.hpp"
 
 namespace hibp
 {
-    class downloader final
+    /**
+     * Downloads the ranges of the dataset whose digests are `DigestSize`
+     * bytes long, i.e. `Sha1Size` or `NtlmSize`.
+     */
+    template <std::size_t DigestSize>
+    class basic_downloader final
     {
     public:
-        downloader(std::size_t first_prefix, std::size_t last_prefix, std::size_t max_hash_count = 1'000'000);
-        downloader(downloader const &) = delete;
-        downloader(downloader &&) = delete;
+        typedef basic_collection<DigestSize> collection_type;
 
-        void http_worker();
+        basic_downloader(std::size_t first_prefix, std::size_t last_prefix, std::size_t prefix_step, std::size_t num_workers, std::size_t max_hash_count = 1'000'000);
+        basic_downloader(basic_downloader const &) = delete;
+        basic_downloader(basic_downloader &&) = delete;
+
+        /**
+         * Fetch ranges until there are none left.
+         *
+         * @param worker_id number in [0, `worker_count()`) that is unique
+         *        to the calling thread; it tells apart the threads' retry
+         *        jitter.
+         */
+        void http_worker(std::size_t worker_id);
+
+#if defined(__linux__)
+        /**
+         * Like `http_worker()`, but keep up to `connections` requests in
+         * flight at the same time, multiplexed with epoll on the calling
+         * thread.
+         */
+        void event_worker(std::size_t worker_id, std::size_t connections);
+#endif
+
+        /**
+         * Number of threads that should run `http_worker()`. This is the
+         * number of workers passed to the constructor, but not more than
+         * there are ranges to download.
+         */
+        inline std::size_t worker_count() const
+        {
+            return num_workers_;
+        }
 
         inline void set_quiet(bool quiet)
         {
             quiet_ = quiet;
         }
 
+        /**
+         * Scheme, host and optional port of the Pwned Passwords API,
+         * e.g. to point the workers at a local `hibpmock` server.
+         */
+        inline void set_api_url(std::string const &api_url)
+        {
+            api_url_ = api_url;
+        }
+
         inline void set_verbosity(int verbosity)
         {
             verbosity_ = verbosity;
         }
 
-        inline std::size_t queue_size() const
+        inline void set_retry_policy(retry_policy const &policy)
         {
-            return hash_queue_.size();
+            retry_policy_ = policy;
         }
 
-        inline collection_t const &collection() const
+        /**
+         * Whether to ask for gzip-compressed responses, see
+         * `compression_advisor`. Compression stays off if the build
+         * doesn't include an inflate backend, see `inflater`.
+         */
+        inline void set_compression(compression_mode mode)
         {
-            return collection_;
+            compression_.set_mode(inflater::available() ? mode : compression_mode::off);
         }
 
-        collection_t const &finalize()
+        /**
+         * Revalidate ranges against a previous run: ranges with a known
+         * ETag or Last-Modified in `previous_validators` are requested
+         * conditionally, and those answered with 304 Not Modified are
+         * copied from `previous_output`.
+         * @throws std::runtime_error if either file cannot be read
+         */
+        void refresh_from(std::filesystem::path const &previous_output, std::filesystem::path const &previous_validators);
+
+        /**
+         * ETag and Last-Modified of the ranges downloaded so far.
+         */
+        inline etag_store &validators()
+        {
+            return validators_;
+        }
+
+        /**
+         * Ranges that couldn't be downloaded within the retry policy's
+         * attempt budget, in ascending order. Their batches are
+         * handed out by `next_batch()` nonetheless, see
+         * `batch_failed_count()`.
+         */
+        std::vector<std::size_t> failed_ranges() const;
+
+        /**
+         * Number of ranges not yet handed to a worker.
+         */
+        inline std::size_t remaining() const
+        {
+            return dispenser_.remaining();
+        }
+
+        /**
+         * Connection and request counters of this run.
+         */
+        inline download_stats const &stats() const
+        {
+            return stats_;
+        }
+
+        inline collection_type const &collection() const
         {
-            std::sort(collection_.begin(), collection_.end(), smallest_hash_first());
             return collection_;
         }
 
+        /**
+         * Range of prefixes [first, last) of the batch most recently
+         * returned by `next_batch()`.
+         */
+        inline std::pair<std::size_t, std::size_t> batch_range() const
+        {
+            return batch_range_;
+        }
+
+        /**
+         * Block until the next batch of `prefix_step` prefixes has been
+         * downloaded completely and make it the current batch.
+         * The workers don't wait for the caller; they carry on with the
+         * following batches meanwhile.
+         *
+         * @return `false` if there are no more batches or the downloader
+         *         has been stopped.
+         */
+        bool next_batch();
+
+        /**
+         * Number of hashes in the current batch.
+         */
+        std::size_t batch_hash_count() const;
+
+        /**
+         * Number of ranges of the current batch that couldn't be
+         * downloaded. Unless it's 0, the batch has gaps.
+         */
+        inline std::size_t batch_failed_count() const
+        {
+            return batches_[current_batch_].failed.load();
+        }
+
+        /**
+         * Concatenate the per-range results of the current batch into
+         * `collection()`. Each range's records are sorted already, and
+         * the ranges don't overlap, so no sorting is needed beyond that.
+         */
+        collection_type const &finalize();
+
+        /**
+         * Hand over the records `finalize()` collected, e.g. to a
+         * `basic_batch_writer`, leaving `collection()` empty.
+         */
+        inline collection_type take_collection()
+        {
+            return std::exchange(collection_, collection_type{});
+        }
+
+        /**
+         * Make the workers quit and `next_batch()` return `false`.
+         * Takes locks, so it mustn't be called from a signal handler.
+         */
         void stop();
 
-        static const std::string ApiUrl;
+        static const std::string DefaultApiUrl;
         static const std::string DefaultUserAgent;
 
+        /**
+         * Number of batches beyond the one last returned by `next_batch()`
+         * the workers may download before they have to wait for the
+         * caller to catch up.
+         */
+        static constexpr std::size_t MaxBatchesAhead = 2;
+
+        /**
+         * The unit of work is a single `/range/XXXXX` request, so each
+         * 4-digit prefix passed to the constructor yields 16 of them.
+         */
+        static constexpr std::size_t RangesPerPrefix = 0x10;
+
     private:
-        std::queue<hash_prefix_t> hash_queue_;
-        collection_t collection_;
-        std::mutex queue_mutex_;
+        struct batch
+        {
+            // one output buffer per range, in prefix order; as each range is
+            // downloaded by one worker at a time, they need no locking
+            std::vector<collection_type> slots;
+            std::atomic<std::size_t> pending{0};
+            std::atomic<std::size_t> failed{0};
+        };
+        std::size_t first_prefix_;
+        std::size_t last_prefix_;
+        std::size_t prefix_step_;
+        std::size_t ranges_per_batch_;
+        std::size_t num_workers_;
+        std::size_t max_hash_count_;
+        range_dispenser dispenser_;
+        std::atomic<std::size_t> batches_delivered_{0};
+        std::atomic<std::size_t> hashes_collected_{0};
+        std::vector<batch> batches_;
+        std::size_t current_batch_{0};
+        collection_type collection_;
+        std::pair<std::size_t, std::size_t> batch_range_;
+        download_stats stats_;
+        std::string api_url_{DefaultApiUrl};
+        retry_policy retry_policy_;
+        compression_advisor compression_{inflater::available() ? compression_mode::automatic : compression_mode::off};
+        std::vector<std::size_t> failed_ranges_;
+        mutable std::mutex failed_mutex_;
+        etag_store validators_;
+        std::unique_ptr<etag_store> previous_validators_;
+        std::unique_ptr<basic_range_archive<DigestSize>> previous_output_;
+        std::mutex window_mutex_;
         std::mutex output_mutex_;
-        std::mutex collection_mutex_;
+        std::mutex batch_mutex_;
+        std::condition_variable window_cv_;
+        std::condition_variable batch_cv_;
         std::atomic_bool do_quit_ = ATOMIC_VAR_INIT(false);
         int verbosity_{0};
         bool quiet_{false};
 
+        std::size_t batch_of(std::size_t range) const;
+        bool within_window(std::size_t range) const;
+        collection_type &slot_of(std::size_t range);
+        void store(std::size_t range, std::size_t n);
+        bool conditional(std::size_t range) const;
+        bool store_unmodified(std::size_t range, std::string const &etag, std::string const &last_modified);
+        std::vector<std::pair<std::string, std::string>> request_headers(std::size_t range, bool compress) const;
+        void rate_compression(bool compressed, std::uint64_t inflate_ns, std::size_t hashes);
+        void finish(std::size_t range);
+        std::optional<std::chrono::milliseconds> after_failure(
+            std::size_t range,
+            std::size_t failures,
+            bool transient,
+            std::optional<std::chrono::milliseconds> retry_after,
+            std::string const &reason,
+            std::mt19937 &rng);
+        bool pause(std::chrono::milliseconds delay);
         void log(std::string const &message);
         void warning(std::string const &message);
         void error(std::string const &message);
     };
 
+    typedef basic_downloader<Sha1Size> downloader;
+    typedef basic_downloader<NtlmSize> ntlm_downloader;
+
+    extern template class basic_downloader<Sha1Size>;
+    extern template class basic_downloader<NtlmSize>;
 }
 
 #endif // __HIBPDL_HPP__
@@ -0,0 +1,357 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <getopt.hpp>
+#include <iostream>
+#include <random>
+#include <signal.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <httplib.h>
+
+#if defined(HIBPMOCK_WITH_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "range_generator.hpp"
+
+namespace chrono = std::chrono;
+
+namespace
+{
+    const std::string DefaultHost = "127.0.0.1";
+    constexpr int DefaultPort = 8080;
+    constexpr std::size_t DefaultNumThreads = 256U;
+    constexpr std::size_t DefaultKeepAliveMaxCount = 100U;
+
+    enum class latency_distribution
+    {
+        constant,
+        uniform,
+        exponential
+    };
+
+    struct mock_options
+    {
+        std::size_t mean_records{hibp::range_generator::DefaultMeanRecords};
+        std::uint64_t seed{0};
+        double latency_ms{0};
+        latency_distribution distribution{latency_distribution::constant};
+        bool gzip{false};
+        double error_rate{0};
+        double throttle_rate{0};
+        int retry_after{1};
+    };
+
+    void about()
+    {
+        std::cout << "hibpmock - synthetic /range server for benchmarking " << PROJECT_NAME << " " << PROJECT_VERSION << "\n"
+                  << "Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>\n\n";
+    }
+
+    void usage()
+    {
+        std::cout
+            << "USAGE: hibpmock [options]\n"
+               "\n"
+               "Serves deterministic /range/XXXXX responses (SHA-1, or NTLM\n"
+               "with ?mode=ntlm) in the format of the Pwned Passwords API,\n"
+               "e.g. for\n"
+               "\n"
+               "  "
+            << PROJECT_NAME << " --api-url http://" << DefaultHost << ":" << DefaultPort << "\n"
+            << "\n"
+               "OPTIONS:\n"
+               "\n"
+               "  -H HOST [--host HOST]\n"
+               "    Listen on HOST (default: "
+            << DefaultHost << ")\n"
+            << "\n"
+               "  -p PORT [--port PORT]\n"
+               "    Listen on PORT (default: "
+            << DefaultPort << ")\n"
+            << "\n"
+               "  -t N [--threads N]\n"
+               "    Serve up to N connections at once (default: "
+            << DefaultNumThreads << ")\n"
+            << "\n"
+               "  -k N [--keep-alive N]\n"
+               "    Close a connection after N requests (default: "
+            << DefaultKeepAliveMaxCount << ")\n"
+            << "\n"
+               "  -n N [--records N]\n"
+               "    Mean number of records per range (default: "
+            << hibp::range_generator::DefaultMeanRecords << ")\n"
+            << "\n"
+               "  -s SEED [--seed SEED]\n"
+               "    Seed for the generated records (default: 0)\n"
+               "\n"
+               "  -l MS [--latency MS]\n"
+               "    Mean delay in milliseconds before responding (default: 0)\n"
+               "\n"
+               "  -d DIST [--distribution DIST]\n"
+               "    Distribution of the delay, one of:\n"
+               "      constant     always MS (default)\n"
+               "      uniform      between 0 and 2*MS\n"
+               "      exponential  exponentially distributed with mean MS\n"
+               "\n"
+               "  -z [--gzip]\n"
+               "    Compress responses if the client accepts gzip.\n"
+#if !defined(HIBPMOCK_WITH_ZLIB)
+               "    (not available in this build)\n"
+#endif
+               "\n"
+               "  -e P [--error-rate P]\n"
+               "    Answer a fraction P of the requests with 503.\n"
+               "\n"
+               "  -T P [--throttle-rate P]\n"
+               "    Answer a fraction P of the requests with 429.\n"
+               "\n"
+               "  -r S [--retry-after S]\n"
+               "    Value of the Retry-After header sent along with\n"
+               "    429 and 503 (default: 1)\n"
+               "\n"
+               "  --help\n"
+               "    Display this help\n"
+               "\n";
+    }
+
+    double probability(std::string const &arg)
+    {
+        double const p = std::stod(arg);
+        if (p < 0 || p > 1)
+        {
+            std::cerr << "\u001b[31;1mERROR: invalid value, must be between 0 and 1.\u001b[0m" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return p;
+    }
+
+#if defined(HIBPMOCK_WITH_ZLIB)
+    std::string gzip(std::string_view data)
+    {
+        z_stream zs{};
+        // 15 window bits plus 16 selects the gzip wrapper
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return {};
+        }
+        std::string out(deflateBound(&zs, static_cast<uLong>(data.size())), '\0');
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+        zs.avail_in = static_cast<uInt>(data.size());
+        zs.next_out = reinterpret_cast<Bytef *>(out.data());
+        zs.avail_out = static_cast<uInt>(out.size());
+        int const rc = deflate(&zs, Z_FINISH);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return rc == Z_STREAM_END ? out : std::string{};
+    }
+#endif
+
+    chrono::microseconds latency(mock_options const &options, std::mt19937 &rng)
+    {
+        double ms = options.latency_ms;
+        switch (options.distribution)
+        {
+        case latency_distribution::constant:
+            break;
+        case latency_distribution::uniform:
+            ms = std::uniform_real_distribution<double>(0, 2 * options.latency_ms)(rng);
+            break;
+        case latency_distribution::exponential:
+            ms = std::exponential_distribution<double>(1 / options.latency_ms)(rng);
+            break;
+        }
+        return chrono::microseconds(static_cast<chrono::microseconds::rep>(1000 * ms));
+    }
+}
+
+httplib::Server *server = nullptr;
+void signal_handler(int)
+{
+    if (server != nullptr)
+    {
+        server->stop();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string host{DefaultHost};
+    int port{DefaultPort};
+    std::size_t num_threads{DefaultNumThreads};
+    std::size_t keep_alive_max_count{DefaultKeepAliveMaxCount};
+    mock_options options;
+
+    using argparser = argparser::argparser;
+    argparser opt(argc, argv);
+    opt.reg({"-H", "--host"}, argparser::required_argument,
+            [&host](std::string const &arg)
+            {
+                host = arg;
+            });
+    opt.reg({"-p", "--port"}, argparser::required_argument,
+            [&port](std::string const &arg)
+            {
+                port = std::stoi(arg);
+            });
+    opt.reg({"-t", "--threads"}, argparser::required_argument,
+            [&num_threads](std::string const &arg)
+            {
+                num_threads = std::max<std::size_t>(1, std::stoul(arg));
+            });
+    opt.reg({"-k", "--keep-alive"}, argparser::required_argument,
+            [&keep_alive_max_count](std::string const &arg)
+            {
+                keep_alive_max_count = std::max<std::size_t>(1, std::stoul(arg));
+            });
+    opt.reg({"-n", "--records"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                options.mean_records = std::stoul(arg);
+            });
+    opt.reg({"-s", "--seed"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                options.seed = std::stoull(arg);
+            });
+    opt.reg({"-l", "--latency"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                options.latency_ms = std::max(0.0, std::stod(arg));
+            });
+    opt.reg({"-d", "--distribution"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                if (arg == "constant")
+                {
+                    options.distribution = latency_distribution::constant;
+                }
+                else if (arg == "uniform")
+                {
+                    options.distribution = latency_distribution::uniform;
+                }
+                else if (arg == "exponential")
+                {
+                    options.distribution = latency_distribution::exponential;
+                }
+                else
+                {
+                    std::cerr << "\u001b[31;1mERROR: unknown distribution `" << arg << "`.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            });
+    opt.reg({"-z", "--gzip"}, argparser::no_argument,
+            [&options](std::string const &)
+            {
+#if defined(HIBPMOCK_WITH_ZLIB)
+                options.gzip = true;
+#else
+                std::cerr << "\u001b[31;1mERROR: hibpmock has been built without zlib.\u001b[0m" << std::endl;
+                exit(EXIT_FAILURE);
+#endif
+            });
+    opt.reg({"-e", "--error-rate"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                options.error_rate = probability(arg);
+            });
+    opt.reg({"-T", "--throttle-rate"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                options.throttle_rate = probability(arg);
+            });
+    opt.reg({"-r", "--retry-after"}, argparser::required_argument,
+            [&options](std::string const &arg)
+            {
+                options.retry_after = std::max(0, std::stoi(arg));
+            });
+    opt.reg({"-?", "--help"}, argparser::no_argument,
+            [](std::string const &)
+            {
+                about();
+                usage();
+                exit(EXIT_SUCCESS);
+            });
+    try
+    {
+        opt();
+    }
+    catch (::argparser::argument_required_exception const &e)
+    {
+        std::cerr << e.what() << '\n';
+    }
+
+    hibp::range_generator const generate{options.mean_records, options.seed};
+    httplib::Server svr;
+    svr.new_task_queue = [num_threads]
+    {
+        return new httplib::ThreadPool(num_threads);
+    };
+    svr.set_keep_alive_max_count(keep_alive_max_count);
+    svr.Get(R"(/range/([0-9A-Fa-f]{5}))",
+            [&options, &generate](httplib::Request const &req, httplib::Response &res)
+            {
+                thread_local std::mt19937 rng{std::random_device{}()};
+                if (options.latency_ms > 0)
+                {
+                    std::this_thread::sleep_for(latency(options, rng));
+                }
+                double const dice = std::uniform_real_distribution<double>(0, 1)(rng);
+                if (dice < options.error_rate + options.throttle_rate)
+                {
+                    res.status = dice < options.error_rate ? 503 : 429;
+                    res.set_header("Retry-After", std::to_string(options.retry_after));
+                    return;
+                }
+                std::size_t const range = std::stoul(req.matches[1].str(), nullptr, 16);
+                bool const ntlm = req.get_param_value("mode") == "ntlm";
+                // the body only depends on seed, mode and range, and so does the ETag
+                std::ostringstream etag;
+                etag << "W/\"" << std::hex << options.seed << '-' << (ntlm ? "ntlm-" : "") << range << '"';
+                res.set_header("Cache-Control", "public, max-age=2678400");
+                res.set_header("ETag", etag.str());
+                if (req.get_header_value("If-None-Match") == etag.str())
+                {
+                    res.status = 304;
+                    return;
+                }
+                std::string body = generate(range, ntlm ? 16 : 20);
+#if defined(HIBPMOCK_WITH_ZLIB)
+                if (options.gzip && req.get_header_value("Accept-Encoding").find("gzip") != std::string::npos)
+                {
+                    std::string compressed = gzip(body);
+                    if (!compressed.empty())
+                    {
+                        res.set_header("Content-Encoding", "gzip");
+                        body = std::move(compressed);
+                    }
+                }
+#endif
+                res.set_content(body, "text/plain");
+            });
+
+    server = &svr;
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+#elif defined(_MSC_VER)
+    signal(SIGINT, signal_handler);
+#endif
+    std::cout << "Listening on http://" << host << ":" << port << " ..." << std::endl;
+    if (!svr.listen(host, port))
+    {
+        std::cerr << "\u001b[31;1mERROR: cannot listen on " << host << ":" << port << ".\u001b[0m" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
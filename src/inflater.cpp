@@ -0,0 +1,264 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#if defined(HIBPDL_WITH_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(HIBPDL_WITH_ZLIB)
+#include <array>
+#include <zlib.h>
+#endif
+
+#include "inflater.hpp"
+
+namespace hibp
+{
+#if defined(HIBPDL_WITH_LIBDEFLATE) || defined(HIBPDL_WITH_ZLIB)
+    namespace
+    {
+        std::uint64_t nanoseconds_since(std::chrono::steady_clock::time_point t0)
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        }
+    }
+#endif
+
+#if defined(HIBPDL_WITH_LIBDEFLATE)
+
+    struct inflater::impl
+    {
+        libdeflate_decompressor *decompressor{libdeflate_alloc_decompressor()};
+        std::string in;
+        std::string out;
+
+        impl()
+        {
+            if (decompressor == nullptr)
+            {
+                throw std::runtime_error("libdeflate_alloc_decompressor() failed");
+            }
+        }
+
+        ~impl()
+        {
+            libdeflate_free_decompressor(decompressor);
+        }
+    };
+
+    bool inflater::available()
+    {
+        return true;
+    }
+
+    char const *inflater::backend()
+    {
+        return "libdeflate";
+    }
+
+    void inflater::reset()
+    {
+        impl_->in.clear();
+        bytes_in_ = 0;
+        bytes_out_ = 0;
+        inflate_ns_ = 0;
+    }
+
+    bool inflater::feed(std::string_view chunk, sink const &)
+    {
+        impl_->in.append(chunk);
+        bytes_in_ += chunk.size();
+        return true;
+    }
+
+    bool inflater::finish(sink const &out)
+    {
+        std::string const &in = impl_->in;
+        // the gzip trailer ends with the size of the original data modulo 2^32
+        constexpr std::size_t MinGzipSize = 18;
+        if (in.size() < MinGzipSize)
+        {
+            return false;
+        }
+        std::size_t const isize = static_cast<std::size_t>(static_cast<std::uint8_t>(in[in.size() - 4])) |
+                                  static_cast<std::size_t>(static_cast<std::uint8_t>(in[in.size() - 3])) << 8 |
+                                  static_cast<std::size_t>(static_cast<std::uint8_t>(in[in.size() - 2])) << 16 |
+                                  static_cast<std::size_t>(static_cast<std::uint8_t>(in[in.size() - 1])) << 24;
+        // deflate can't compress better than about 1:1032, so a larger
+        // size is a corrupt trailer and mustn't make us allocate gigabytes
+        if (isize > 1032 * in.size())
+        {
+            return false;
+        }
+        std::string &buf = impl_->out;
+        if (buf.size() < isize)
+        {
+            buf.resize(isize);
+        }
+        auto const t0 = std::chrono::steady_clock::now();
+        std::size_t actual = 0;
+        libdeflate_result rc;
+        while ((rc = libdeflate_gzip_decompress(impl_->decompressor, in.data(), in.size(), buf.data(), buf.size(), &actual)) == LIBDEFLATE_INSUFFICIENT_SPACE)
+        {
+            buf.resize(2 * buf.size() + 1);
+        }
+        inflate_ns_ += nanoseconds_since(t0);
+        if (rc != LIBDEFLATE_SUCCESS)
+        {
+            return false;
+        }
+        bytes_out_ += actual;
+        if (actual > 0)
+        {
+            out(std::string_view(buf.data(), actual));
+        }
+        return true;
+    }
+
+#elif defined(HIBPDL_WITH_ZLIB)
+
+    struct inflater::impl
+    {
+        static constexpr std::size_t OutChunkSize = 64 * 1024;
+
+        z_stream zs{};
+        bool ended{false};
+        std::array<char, OutChunkSize> out;
+
+        impl()
+        {
+            // 32 added to the window bits accepts both gzip and zlib headers
+            if (inflateInit2(&zs, 15 + 32) != Z_OK)
+            {
+                throw std::runtime_error("inflateInit2() failed");
+            }
+        }
+
+        ~impl()
+        {
+            inflateEnd(&zs);
+        }
+    };
+
+    bool inflater::available()
+    {
+        return true;
+    }
+
+    char const *inflater::backend()
+    {
+        return "zlib";
+    }
+
+    void inflater::reset()
+    {
+        inflateReset(&impl_->zs);
+        impl_->ended = false;
+        bytes_in_ = 0;
+        bytes_out_ = 0;
+        inflate_ns_ = 0;
+    }
+
+    bool inflater::feed(std::string_view chunk, sink const &out)
+    {
+        z_stream &zs = impl_->zs;
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(chunk.data()));
+        zs.avail_in = static_cast<uInt>(chunk.size());
+        bytes_in_ += chunk.size();
+        for (;;)
+        {
+            if (impl_->ended)
+            {
+                if (zs.avail_in == 0)
+                {
+                    break;
+                }
+                // another gzip member follows
+                inflateReset(&zs);
+                impl_->ended = false;
+            }
+            zs.next_out = reinterpret_cast<Bytef *>(impl_->out.data());
+            zs.avail_out = static_cast<uInt>(impl_->out.size());
+            auto const t0 = std::chrono::steady_clock::now();
+            int const rc = inflate(&zs, Z_NO_FLUSH);
+            inflate_ns_ += nanoseconds_since(t0);
+            if (rc == Z_STREAM_END)
+            {
+                impl_->ended = true;
+            }
+            else if (rc != Z_OK && rc != Z_BUF_ERROR)
+            {
+                return false;
+            }
+            std::size_t const produced = impl_->out.size() - zs.avail_out;
+            bytes_out_ += produced;
+            if (produced > 0)
+            {
+                out(std::string_view(impl_->out.data(), produced));
+            }
+            else if (rc == Z_BUF_ERROR && zs.avail_in > 0)
+            {
+                return false;
+            }
+            if (zs.avail_in == 0 && zs.avail_out > 0)
+            {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool inflater::finish(sink const &)
+    {
+        return impl_->ended;
+    }
+
+#else
+
+    struct inflater::impl
+    {
+    };
+
+    bool inflater::available()
+    {
+        return false;
+    }
+
+    char const *inflater::backend()
+    {
+        return "none";
+    }
+
+    void inflater::reset()
+    {
+        bytes_in_ = 0;
+        bytes_out_ = 0;
+        inflate_ns_ = 0;
+    }
+
+    bool inflater::feed(std::string_view chunk, sink const &)
+    {
+        bytes_in_ += chunk.size();
+        return false;
+    }
+
+    bool inflater::finish(sink const &)
+    {
+        return false;
+    }
+
+#endif
+
+    inflater::inflater()
+        : impl_(std::make_unique<impl>())
+    {
+    }
+
+    inflater::inflater(inflater &&) noexcept = default;
+    inflater &inflater::operator=(inflater &&) noexcept = default;
+    inflater::~inflater() = default;
+}
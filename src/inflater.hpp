@@ -0,0 +1,93 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __INFLATER_HPP__
+#define __INFLATER_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+namespace hibp
+{
+    /**
+     * Decompresses gzip-encoded response bodies as they arrive.
+     *
+     * The backend is chosen at build time: libdeflate if it's available
+     * (`HIBPDL_WITH_LIBDEFLATE`), which is considerably faster but can
+     * only decode a body as a whole, so the compressed bytes are
+     * collected until `finish()`; otherwise zlib (`HIBPDL_WITH_ZLIB`),
+     * or zlib-ng in its zlib-compatible flavour, which decodes each
+     * chunk right away. Without either, `available()` is `false` and
+     * the downloader doesn't ask for compressed responses.
+     *
+     * Each instance decodes one body at a time and can be reused after
+     * `reset()` without allocating.
+     */
+    class inflater final
+    {
+    public:
+        /** receives the decompressed data piece by piece */
+        using sink = std::function<void(std::string_view)>;
+
+        static bool available();
+
+        /**
+         * Name of the backend, e.g. for the statistics.
+         */
+        static char const *backend();
+
+        inflater();
+        inflater(inflater &&) noexcept;
+        inflater &operator=(inflater &&) noexcept;
+        ~inflater();
+
+        /**
+         * Get ready for the next body.
+         */
+        void reset();
+
+        /**
+         * Decompress `chunk`, passing what comes out to `out`.
+         * @return `false` if the data is corrupt
+         */
+        bool feed(std::string_view chunk, sink const &out);
+
+        /**
+         * Decompress what's left of the body.
+         * @return `false` if the data is corrupt or incomplete
+         */
+        bool finish(sink const &out);
+
+        /** compressed bytes of the current body consumed so far */
+        inline std::uint64_t bytes_in() const
+        {
+            return bytes_in_;
+        }
+
+        /** decompressed bytes of the current body produced so far */
+        inline std::uint64_t bytes_out() const
+        {
+            return bytes_out_;
+        }
+
+        /** time spent decompressing the current body, the sink excluded */
+        inline std::uint64_t inflate_ns() const
+        {
+            return inflate_ns_;
+        }
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> impl_;
+        std::uint64_t bytes_in_{0};
+        std::uint64_t bytes_out_{0};
+        std::uint64_t inflate_ns_{0};
+    };
+}
+
+#endif // __INFLATER_HPP__
@@ -4,7 +4,10 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <ctime>
 #include <cstdlib>
 #include <cstring>
 #include <filesystem>
@@ -16,13 +19,18 @@
 #include <memory>
 #include <mutex>
 #include <numeric>
+#include <sstream>
 #include <thread>
 #include <signal.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "timer.hpp"
 #include "util.hpp"
+#include "batch_writer.hpp"
+#include "compact_format.hpp"
+#include "hash_merger.hpp"
 #include "hibpdl.hpp"
 
 #if _MSC_VER
@@ -46,9 +54,13 @@ namespace fs = std::filesystem;
 namespace
 {
     constexpr size_t DefaultNumThreads = 4U;
+    constexpr size_t DefaultConnectionsPerThread = 64U;
     const std::string DefaultOutputFilename = "hash+count.bin";
+    const std::string DefaultNtlmOutputFilename = "ntlm+count.bin";
     const std::string DefaultCheckpointFilename = "checkpoint";
     const std::string DefaultLockFilename = "lock";
+    const std::string DefaultFailedFilename = "failed";
+    const std::string ValidatorsExtension = ".etags";
     constexpr std::size_t DefaultHashPrefixStep = 0x0040;
     constexpr std::size_t MaxHashPrefix = 1UL << (4 * 4);
 
@@ -90,6 +102,14 @@ namespace
 #endif
     }
 
+    /**
+     * Sidecar file holding the ETags of the ranges in `output_filename`.
+     */
+    fs::path validators_filename_for(fs::path const &output_filename)
+    {
+        return fs::path(output_filename.string() + ValidatorsExtension);
+    }
+
     void usage()
     {
         std::cout
@@ -97,6 +117,12 @@ namespace
                "USAGE: "
             << PROJECT_NAME
             << " [options]\n"
+               "       "
+            << PROJECT_NAME
+            << " merge [merge options]\n"
+               "       "
+            << PROJECT_NAME
+            << " convert [convert options]\n"
                "\n"
                "OPTIONS:\n"
                "\n"
@@ -104,7 +130,14 @@ namespace
                "    Write result to FILENAME.\n"
                "    Default: `"
             << DefaultOutputFilename
-            << "`\n\n"
+            << "`, or `"
+            << DefaultNtlmOutputFilename
+            << "` in NTLM mode\n\n"
+               "  -m MODE [--mode MODE]\n"
+               "    Download the hashes of MODE, one of:\n"
+               "      sha1  SHA-1 hashes, 20+4 bytes per record (default)\n"
+               "      ntlm  NTLM hashes, 16+4 bytes per record\n"
+               "\n"
                "  -v [--verbose]\n"
                "    Increase verbosity of output.\n"
                "\n"
@@ -112,6 +145,47 @@ namespace
                "    Run in N threads (default: "
             << std::dec << std::max(static_cast<std::size_t>(std::thread::hardware_concurrency()), DefaultNumThreads) << ")"
             << "\n"
+               "\n"
+               "  -E ENGINE [--engine ENGINE]\n"
+               "    Download with ENGINE, one of:\n"
+               "      blocking  one request at a time per thread (default)\n"
+#if defined(__linux__)
+               "      event     many requests in flight per thread (epoll)\n"
+#endif
+               "\n"
+               "  -c N [--connections N]\n"
+               "    Keep up to N requests per thread in flight when\n"
+               "    using the `event` engine (default: "
+            << std::dec << DefaultConnectionsPerThread << ")"
+            << "\n"
+               "\n"
+               "  -R FILENAME [--refresh-from FILENAME]\n"
+               "    Only download ranges that have changed since the run\n"
+               "    that wrote FILENAME and copy the others from there.\n"
+               "    Needs the ETags that run stored in FILENAME"
+            << ValidatorsExtension << ".\n"
+            << "\n"
+               "  -U URL [--api-url URL]\n"
+               "    Fetch ranges from URL instead of\n"
+               "    "
+            << hibp::downloader::DefaultApiUrl << "\n"
+            << "    e.g. from a local `hibpmock` server.\n"
+               "\n"
+               "  -z MODE [--compression MODE]\n"
+               "    Ask for gzip-compressed responses (`on`), or not (`off`),\n"
+               "    or whichever yields more hashes per second (`auto`).\n"
+               "    Default: `"
+            << (hibp::inflater::available() ? "auto" : "off") << "`, inflating with "
+            << hibp::inflater::backend() << ".\n"
+               "\n"
+               "  -A N [--max-attempts N]\n"
+               "    Give up on a range after N failed attempts (default: "
+            << std::dec << hibp::retry_policy{}.max_attempts << ").\n"
+               "    Failed attempts are retried with exponential backoff.\n"
+               "    Ranges given up are listed in `~/.hibpdl/"
+            << DefaultFailedFilename << "`, and the\n"
+               "    output stops before the first of them, so that running\n"
+               "    again continues from there.\n"
                "\n"
                "  -P PREFIX [--first-prefix]\n"
                "    Begin reading a prefix PREFIX.\n"
@@ -127,6 +201,12 @@ namespace
                "    Default: `"
             << std::hex << std::setw(4) << std::setfill('0') << DefaultHashPrefixStep
             << "`\n"
+               "  -D [--direct-io]\n"
+               "    Write the output with O_DIRECT through io_uring, bypassing\n"
+               "    the page cache, where the file system allows"
+            << (hibp::direct_writer::available() ? "" : " (not in this\n    build, which lacks liburing)")
+            << ".\n"
+               "\n"
                "  -y\n"
                "    Answer YES to all questions.\n"
                "\n"
@@ -138,27 +218,394 @@ namespace
                "\n"
                "  --license\n"
                "    Display license\n"
+               "\n"
+               "See `"
+            << PROJECT_NAME
+            << " merge --help` for the merge options and `"
+            << PROJECT_NAME
+            << " convert --help`\n"
+               "for converting to and from the compact format.\n"
+               "\n";
+    }
+
+    void merge_usage()
+    {
+        std::cout
+            << "\n"
+               "USAGE: "
+            << PROJECT_NAME
+            << " merge [merge options] -i FILENAME -i FILENAME ... -o FILENAME\n"
+               "\n"
+               "Merge files of records as written by "
+            << PROJECT_NAME
+            << " into one sorted file\n"
+               "without duplicates. Unsorted inputs are sorted first.\n"
+               "\n"
+               "MERGE OPTIONS:\n"
+               "\n"
+               "  -i FILENAME [--input FILENAME]\n"
+               "    Read records from FILENAME. Repeat for each input.\n"
+               "\n"
+               "  -o FILENAME [--output FILENAME]\n"
+               "    Write the merged records to FILENAME.\n"
+               "\n"
+               "  -m MODE [--mode MODE]\n"
+               "    The inputs hold records of MODE, `sha1` (default) or `ntlm`.\n"
+               "\n"
+               "  -d POLICY [--duplicates POLICY]\n"
+               "    Combine the counts of a hash found more than once by\n"
+               "    POLICY, `sum` (default) or `max`.\n"
+               "\n"
+               "  -M MB [--memory MB]\n"
+               "    Use up to about MB megabytes for buffers and sorting (default: "
+            << (hibp::hash_merger::DefaultMemoryLimit >> 20) << ").\n"
+               "\n"
+               "  -T DIRECTORY [--temp-dir DIRECTORY]\n"
+               "    Keep the sorted runs of unsorted inputs in DIRECTORY\n"
+               "    (default: the directory of the output file).\n"
                "\n";
     }
+
+    template <std::size_t DigestSize>
+    int merge_files(std::vector<fs::path> const &inputs, fs::path const &output, hibp::duplicate_policy policy, std::size_t memory_limit, fs::path const &temp_directory)
+    {
+        hibp::basic_hash_merger<DigestSize> merger(policy, memory_limit);
+        merger.set_temp_directory(temp_directory);
+        hibp::merge_stats stats;
+        try
+        {
+            stats = merger.merge(inputs, output);
+        }
+        catch (std::exception const &e)
+        {
+            std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Merged " << stats.inputs << " files, "
+                  << stats.records_in << " records (" << (stats.input_bytes >> 20) << " MB), into "
+                  << stats.records_out << " records in "
+                  << std::fixed << std::setprecision(3) << 1e-9 * static_cast<double>(stats.elapsed_ns) << " s, "
+                  << std::setprecision(1) << stats.mb_per_second() << " MB/s\n"
+                  << "Duplicates combined: " << stats.duplicates << '\n'
+                  << "Unsorted inputs:     " << stats.unsorted_inputs;
+        if (stats.unsorted_inputs > 0)
+        {
+            std::cout << ", sorted in " << stats.runs << " runs";
+        }
+        std::cout << "\nRead " << (stats.bytes_read >> 20) << " MB, wrote " << (stats.bytes_written >> 20) << " MB" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    void convert_usage()
+    {
+        std::cout
+            << "\n"
+               "USAGE: "
+            << PROJECT_NAME
+            << " convert [convert options] -i FILENAME -o FILENAME\n"
+               "\n"
+               "Convert a sorted file of records as written by "
+            << PROJECT_NAME
+            << " into the compact\n"
+               "format, which leaves out the prefix bits implied by a bucket table\n"
+               "and stores small counts in fewer bytes, or a compact file back into\n"
+               "records. The direction follows from the input.\n"
+               "\n"
+               "CONVERT OPTIONS:\n"
+               "\n"
+               "  -i FILENAME [--input FILENAME]\n"
+               "    Read from FILENAME.\n"
+               "\n"
+               "  -o FILENAME [--output FILENAME]\n"
+               "    Write to FILENAME.\n"
+               "\n"
+               "  -m MODE [--mode MODE]\n"
+               "    A record input holds records of MODE, `sha1` (default) or `ntlm`.\n"
+               "    Compact files record their mode themselves.\n"
+               "\n";
+    }
+
+    template <std::size_t DigestSize>
+    int convert_file(fs::path const &input, fs::path const &output, bool to_compact)
+    {
+        hibp::conversion_stats stats;
+        try
+        {
+            stats = to_compact
+                        ? hibp::convert_to_compact<DigestSize>(input, output)
+                        : hibp::convert_from_compact<DigestSize>(input, output);
+        }
+        catch (std::exception const &e)
+        {
+            std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+        double const seconds = 1e-9 * static_cast<double>(stats.elapsed_ns);
+        std::cout << "Converted " << stats.records << " records "
+                  << (to_compact ? "into the compact format" : "from the compact format")
+                  << " in " << std::fixed << std::setprecision(3) << seconds << " s, "
+                  << std::setprecision(1) << 1e-6 * static_cast<double>(stats.input_bytes) / std::max(seconds, 1e-9) << " MB/s\n"
+                  << "Read " << (stats.input_bytes >> 20) << " MB, wrote " << (stats.output_bytes >> 20) << " MB ("
+                  << 100.0 * static_cast<double>(stats.output_bytes) / static_cast<double>(std::max<std::uint64_t>(1, stats.input_bytes))
+                  << "% of the input)" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    /**
+     * The `convert` subcommand; `argv[0]` is "convert".
+     */
+    int convert_main(int argc, char *argv[])
+    {
+        fs::path input;
+        fs::path output;
+        std::string mode{"sha1"};
+        using argparser = argparser::argparser;
+        argparser opt(argc, argv);
+        opt.reg({"-i", "--input"}, argparser::required_argument,
+                [&input](std::string const &filename)
+                {
+                    input = filename;
+                });
+        opt.reg({"-o", "--output"}, argparser::required_argument,
+                [&output](std::string const &filename)
+                {
+                    output = filename;
+                });
+        opt.reg({"-m", "--mode"}, argparser::required_argument,
+                [&mode](std::string const &arg)
+                {
+                    mode = arg;
+                    if (mode != "sha1" && mode != "ntlm")
+                    {
+                        std::cerr << "\u001b[31;1mERROR: unknown mode `" << mode << "`.\u001b[0m" << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                });
+        opt.reg({"-?", "--help"}, argparser::no_argument,
+                [](std::string const &)
+                {
+                    convert_usage();
+                    exit(EXIT_SUCCESS);
+                });
+        try
+        {
+            opt();
+        }
+        catch (::argparser::argument_required_exception const &e)
+        {
+            std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (input.empty() || output.empty())
+        {
+            std::cerr << "\u001b[31;1mERROR: the input and the output file are required.\u001b[0m" << std::endl;
+            convert_usage();
+            return EXIT_FAILURE;
+        }
+        std::size_t const compact_digest_size = hibp::compact::digest_size(input);
+        bool const to_compact = compact_digest_size == 0;
+        bool const ntlm = to_compact ? mode == "ntlm" : compact_digest_size == hibp::NtlmSize;
+        return ntlm
+                   ? convert_file<hibp::NtlmSize>(input, output, to_compact)
+                   : convert_file<hibp::Sha1Size>(input, output, to_compact);
+    }
+
+    /**
+     * The `merge` subcommand; `argv[0]` is "merge".
+     */
+    int merge_main(int argc, char *argv[])
+    {
+        std::vector<fs::path> inputs;
+        fs::path output;
+        std::string mode{"sha1"};
+        hibp::duplicate_policy policy{hibp::duplicate_policy::sum};
+        std::size_t memory_limit{hibp::hash_merger::DefaultMemoryLimit};
+        fs::path temp_directory;
+        using argparser = argparser::argparser;
+        argparser opt(argc, argv);
+        opt.reg({"-i", "--input"}, argparser::required_argument,
+                [&inputs](std::string const &filename)
+                {
+                    inputs.emplace_back(filename);
+                });
+        opt.reg({"-o", "--output"}, argparser::required_argument,
+                [&output](std::string const &filename)
+                {
+                    output = filename;
+                });
+        opt.reg({"-m", "--mode"}, argparser::required_argument,
+                [&mode](std::string const &arg)
+                {
+                    mode = arg;
+                    if (mode != "sha1" && mode != "ntlm")
+                    {
+                        std::cerr << "\u001b[31;1mERROR: unknown mode `" << mode << "`.\u001b[0m" << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                });
+        opt.reg({"-d", "--duplicates"}, argparser::required_argument,
+                [&policy](std::string const &arg)
+                {
+                    if (arg == "sum")
+                    {
+                        policy = hibp::duplicate_policy::sum;
+                    }
+                    else if (arg == "max")
+                    {
+                        policy = hibp::duplicate_policy::max;
+                    }
+                    else
+                    {
+                        std::cerr << "\u001b[31;1mERROR: duplicates must be `sum` or `max`.\u001b[0m" << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                });
+        opt.reg({"-M", "--memory"}, argparser::required_argument,
+                [&memory_limit](std::string const &mb)
+                {
+                    memory_limit = static_cast<std::size_t>(std::stoul(mb)) << 20;
+                    if (memory_limit == 0)
+                    {
+                        std::cerr << "\u001b[31;1mERROR: invalid value, must be > 0.\u001b[0m" << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                });
+        opt.reg({"-T", "--temp-dir"}, argparser::required_argument,
+                [&temp_directory](std::string const &directory)
+                {
+                    temp_directory = directory;
+                });
+        opt.reg({"-?", "--help"}, argparser::no_argument,
+                [](std::string const &)
+                {
+                    merge_usage();
+                    exit(EXIT_SUCCESS);
+                });
+        try
+        {
+            opt();
+        }
+        catch (::argparser::argument_required_exception const &e)
+        {
+            std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (inputs.empty() || output.empty())
+        {
+            std::cerr << "\u001b[31;1mERROR: at least one input and the output file are required.\u001b[0m" << std::endl;
+            merge_usage();
+            return EXIT_FAILURE;
+        }
+        return mode == "ntlm"
+                   ? merge_files<hibp::NtlmSize>(inputs, output, policy, memory_limit, temp_directory)
+                   : merge_files<hibp::Sha1Size>(inputs, output, policy, memory_limit, temp_directory);
+    }
+}
+
+// Raised by the SIGINT handler, which must not do more than that:
+// anything that locks a mutex could deadlock with the very thread the
+// signal interrupted. `interrupt_watcher` takes it from there.
+std::atomic_bool interrupted = ATOMIC_VAR_INIT(false);
+static_assert(std::atomic_bool::is_always_lock_free);
+
+void signal_handler(int)
+{
+    interrupted.store(true);
 }
 
-std::function<void(int)> shutdown_handler;
-void signal_handler(int signal)
+namespace
 {
-    shutdown_handler(signal);
+    /**
+     * Waits on a thread of its own for `interrupted` to be raised and
+     * then calls `on_interrupt`, which, unlike a signal handler, is free
+     * to lock mutexes and print.
+     */
+    class interrupt_watcher final
+    {
+    public:
+        explicit interrupt_watcher(std::function<void()> on_interrupt)
+            : on_interrupt_(std::move(on_interrupt)),
+              thread_(&interrupt_watcher::run, this)
+        {
+        }
+        interrupt_watcher(interrupt_watcher const &) = delete;
+        interrupt_watcher &operator=(interrupt_watcher const &) = delete;
+
+        ~interrupt_watcher()
+        {
+            finish();
+        }
+
+        /**
+         * Stop watching; interrupts from now on are ignored.
+         */
+        void finish()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                finished_ = true;
+            }
+            cv_.notify_all();
+            if (thread_.joinable())
+            {
+                thread_.join();
+            }
+        }
+
+    private:
+        /** how long an interrupt may go unnoticed */
+        static constexpr chrono::milliseconds PollInterval{100};
+
+        std::function<void()> on_interrupt_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool finished_{false};
+        std::thread thread_;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!finished_ && !interrupted.load())
+            {
+                cv_.wait_for(lock, PollInterval);
+            }
+            if (!interrupted.load())
+            {
+                return;
+            }
+            lock.unlock();
+            on_interrupt_();
+        }
+    };
 }
 
 int main(int argc, char *argv[])
 {
-    fs::path output_filename(DefaultOutputFilename);
+    if (argc > 1 && std::strcmp(argv[1], "merge") == 0)
+    {
+        return merge_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "convert") == 0)
+    {
+        return convert_main(argc - 1, argv + 1);
+    }
+    fs::path output_filename;
+    std::string mode{"sha1"};
     std::size_t first_hash_prefix{0};
     std::size_t last_hash_prefix{MaxHashPrefix};
     std::size_t hash_prefix_step{DefaultHashPrefixStep};
     std::size_t num_threads{std::max(
         static_cast<std::size_t>(std::thread::hardware_concurrency()),
         DefaultNumThreads)};
+    std::string engine{"blocking"};
+    std::size_t num_connections{DefaultConnectionsPerThread};
+    std::string api_url{hibp::downloader::DefaultApiUrl};
+    fs::path refresh_filename;
+    hibp::retry_policy retry_policy;
+    hibp::compression_mode compression{hibp::inflater::available() ? hibp::compression_mode::automatic : hibp::compression_mode::off};
     bool yes = false;
     bool quiet = false;
+    bool direct_io = false;
     int verbosity = 0;
 
     fs::path config_directory{get_home_directory() / fs::path(".hibpdl")};
@@ -169,6 +616,7 @@ int main(int argc, char *argv[])
     fs::path checkpoint_filename = config_directory / fs::path(DefaultCheckpointFilename);
 
     fs::path lock_filename = config_directory / fs::path(DefaultLockFilename);
+    fs::path failed_filename = config_directory / fs::path(DefaultFailedFilename);
     if (fs::exists(lock_filename))
     {
         std::ifstream lock_file(lock_filename);
@@ -204,6 +652,16 @@ int main(int argc, char *argv[])
 
     using argparser = argparser::argparser;
     argparser opt(argc, argv);
+    opt.reg({"-m", "--mode"}, argparser::required_argument,
+            [&mode](std::string const &arg)
+            {
+                mode = arg;
+                if (mode != "sha1" && mode != "ntlm")
+                {
+                    std::cerr << "\u001b[31;1mERROR: unknown mode `" << mode << "`.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            });
     opt.reg({"-o", "--output"}, argparser::required_argument,
             [&output_filename](std::string const &filename)
             {
@@ -224,6 +682,81 @@ int main(int argc, char *argv[])
             {
                 ++verbosity;
             });
+    opt.reg({"-E", "--engine"}, argparser::required_argument,
+            [&engine](std::string const &arg)
+            {
+                engine = arg;
+#if defined(__linux__)
+                if (engine != "blocking" && engine != "event")
+#else
+                if (engine != "blocking")
+#endif
+                {
+                    std::cerr << "\u001b[31;1mERROR: unknown engine `" << engine << "`.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            });
+    opt.reg({"-c", "--connections"}, argparser::required_argument,
+            [&num_connections](std::string const &n)
+            {
+                num_connections = static_cast<std::size_t>(std::stoul(n));
+                if (num_connections == 0)
+                {
+                    std::cerr << "\u001b[31;1mERROR: invalid value, must be > 0.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            });
+    opt.reg({"-R", "--refresh-from"}, argparser::required_argument,
+            [&refresh_filename](std::string const &filename)
+            {
+                refresh_filename = filename;
+            });
+    opt.reg({"-U", "--api-url"}, argparser::required_argument,
+            [&api_url](std::string const &url)
+            {
+                if (url.rfind("http://", 0) != 0 && url.rfind("https://", 0) != 0)
+                {
+                    std::cerr << "\u001b[31;1mERROR: URL must begin with http:// or https://.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                api_url = url;
+            });
+    opt.reg({"-z", "--compression"}, argparser::required_argument,
+            [&compression](std::string const &mode)
+            {
+                if (mode == "on")
+                {
+                    compression = hibp::compression_mode::on;
+                }
+                else if (mode == "off")
+                {
+                    compression = hibp::compression_mode::off;
+                }
+                else if (mode == "auto")
+                {
+                    compression = hibp::compression_mode::automatic;
+                }
+                else
+                {
+                    std::cerr << "\u001b[31;1mERROR: compression must be `on`, `off` or `auto`.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                if (compression != hibp::compression_mode::off && !hibp::inflater::available())
+                {
+                    std::cerr << "\u001b[31;1mERROR: this build can't inflate compressed responses.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            });
+    opt.reg({"-A", "--max-attempts"}, argparser::required_argument,
+            [&retry_policy](std::string const &n)
+            {
+                retry_policy.max_attempts = static_cast<std::size_t>(std::stoul(n));
+                if (retry_policy.max_attempts == 0)
+                {
+                    std::cerr << "\u001b[31;1mERROR: invalid value, must be > 0.\u001b[0m" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            });
     opt.reg({"-P", "--first-prefix"}, argparser::required_argument,
             [&first_hash_prefix](std::string const &arg)
             {
@@ -254,6 +787,11 @@ int main(int argc, char *argv[])
                     exit(EXIT_FAILURE);
                 }
             });
+    opt.reg({"-D", "--direct-io"}, argparser::no_argument,
+            [&direct_io](std::string const &)
+            {
+                direct_io = true;
+            });
     opt.reg({"-y", "--yes"}, argparser::no_argument,
             [&yes](std::string const &)
             {
@@ -285,6 +823,25 @@ int main(int argc, char *argv[])
     {
         std::cerr << e.what() << '\n';
     }
+    if (output_filename.empty())
+    {
+        output_filename = mode == "ntlm" ? DefaultNtlmOutputFilename : DefaultOutputFilename;
+    }
+    fs::path const validators_filename = validators_filename_for(output_filename);
+    if (!refresh_filename.empty())
+    {
+        if (!fs::exists(refresh_filename) || !fs::exists(validators_filename_for(refresh_filename)))
+        {
+            std::cerr << "\u001b[31;1mERROR: " << refresh_filename << " or its ETags file "
+                      << validators_filename_for(refresh_filename) << " doesn't exist.\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (fs::exists(output_filename) && fs::equivalent(refresh_filename, output_filename))
+        {
+            std::cerr << "\u001b[31;1mERROR: cannot refresh " << refresh_filename << " in place, please choose another output file.\u001b[0m" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
     if (verbosity > 0)
     {
         about();
@@ -329,6 +886,7 @@ int main(int argc, char *argv[])
             else if (answer == "r")
             {
                 fs::remove(output_filename);
+                fs::remove(validators_filename);
                 fs::remove(checkpoint_filename);
             }
             else if (answer == "q")
@@ -364,6 +922,7 @@ int main(int argc, char *argv[])
         if (c == 'y')
         {
             fs::remove(output_filename);
+            fs::remove(validators_filename);
         }
         else
         {
@@ -397,29 +956,88 @@ int main(int argc, char *argv[])
     lock_file.close();
 
     util::timer t;
-    bool do_quit = false;
-    for (std::size_t hash_prefix = first_hash_prefix;
-         hash_prefix < last_hash_prefix;
-         hash_prefix += hash_prefix_step)
+    std::clock_t const cpu_start = std::clock();
+    std::size_t total_hash_count = 0;
+    std::atomic_bool do_quit = ATOMIC_VAR_INIT(false);
+    // Everything but the record type is the same in both modes.
+    auto download = [&](auto &hibpdl) -> int
     {
+        using downloader_t = std::remove_reference_t<decltype(hibpdl)>;
+        hibpdl.set_verbosity(verbosity);
+        hibpdl.set_quiet(quiet);
+        hibpdl.set_retry_policy(retry_policy);
+        hibpdl.set_compression(compression);
+        hibpdl.set_api_url(api_url);
+        if (first_hash_prefix != 0x0000 && fs::exists(validators_filename))
+        {
+            if (!hibpdl.validators().load(validators_filename))
+            {
+                std::cerr << "\u001b[33mWARNING: cannot read " << validators_filename
+                          << "; the ETags of the ranges downloaded so far are lost.\u001b[0m" << std::endl;
+            }
+        }
+        if (!refresh_filename.empty())
+        {
+            try
+            {
+                hibpdl.refresh_from(refresh_filename, validators_filename_for(refresh_filename));
+            }
+            catch (std::exception const &e)
+            {
+                std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+                fs::remove(lock_filename);
+                return EXIT_FAILURE;
+            }
+        }
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+        struct sigaction sigint_handler;
+        sigint_handler.sa_handler = signal_handler;
+        sigemptyset(&sigint_handler.sa_mask);
+        sigint_handler.sa_flags = 0;
+        sigaction(SIGINT, &sigint_handler, NULL);
+        // a peer closing a TLS connection must not kill the process
+        signal(SIGPIPE, SIG_IGN);
+#elif defined(_MSC_VER)
+        signal(SIGINT, signal_handler);
+#endif
         if (verbosity > 0)
         {
             std::cout
                 << "Fetching hashes in ["
                 << std::hex << std::setw(4) << std::setfill('0')
-                << hash_prefix << "0h, "
+                << first_hash_prefix << "0h, "
+                << std::hex << std::setw(4) << std::setfill('0')
+                << (last_hash_prefix - 1) << "fh] in chunks of "
                 << std::hex << std::setw(4) << std::setfill('0')
-                << (std::min(hash_prefix + hash_prefix_step, MaxHashPrefix) - 1) << "fh] ..."
+                << hash_prefix_step << "h prefixes ..."
                 << std::endl;
         }
-        hibp::downloader hibpdl{
-            hash_prefix,
-            std::min(hash_prefix + hash_prefix_step, MaxHashPrefix)};
-        hibpdl.set_verbosity(verbosity);
-        hibpdl.set_quiet(quiet);
-        std::vector<std::thread> workers;
-        workers.reserve(num_threads);
-        shutdown_handler = [&hibpdl, &do_quit, verbosity](int)
+        // writes each batch while the next one is collected; holds back
+        // the downloader via `push()` if the disk can't keep up
+        using writer_t = hibp::basic_batch_writer<downloader_t::collection_type::value_type::digest_size>;
+        std::unique_ptr<writer_t> writer;
+        try
+        {
+            writer = std::make_unique<writer_t>(output_filename, checkpoint_filename, direct_io);
+        }
+        catch (std::exception const &e)
+        {
+            std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+            fs::remove(lock_filename);
+            return EXIT_FAILURE;
+        }
+        if (verbosity > 0 && direct_io)
+        {
+            if (writer->direct())
+            {
+                std::cout << "Writing with io_uring and O_DIRECT, bypassing the page cache." << std::endl;
+            }
+            else
+            {
+                std::cout << "Writing through the page cache: " << writer->direct_io_unavailable_reason() << "." << std::endl;
+            }
+        }
+        auto const shut_down = [&hibpdl, &do_quit, verbosity]()
         {
             if (verbosity > 0)
             {
@@ -428,85 +1046,182 @@ int main(int argc, char *argv[])
             do_quit = true;
             hibpdl.stop();
         };
-#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
-        struct sigaction sigint_handler;
-        sigint_handler.sa_handler = signal_handler;
-        sigemptyset(&sigint_handler.sa_mask);
-        sigint_handler.sa_flags = 0;
-        sigaction(SIGINT, &sigint_handler, NULL);
-#elif defined(_MSC_VER)
-        signal(SIGINT, signal_handler);
+        interrupt_watcher watcher(shut_down);
+        // The workers and their HTTP clients live for the entire run;
+        // batch boundaries are merely points where results are flushed
+        // and the checkpoint is updated.
+        std::vector<std::thread> workers;
+        workers.reserve(hibpdl.worker_count());
+        for (std::size_t i = 0; i < hibpdl.worker_count(); ++i)
+        {
+#if defined(__linux__)
+            if (engine == "event")
+            {
+                workers.emplace_back(&downloader_t::event_worker, &hibpdl, i, num_connections);
+                continue;
+            }
 #endif
-        std::size_t start_thread_count = std::min(num_threads, hibpdl.queue_size());
-        for (std::size_t i = 0; i < start_thread_count; ++i)
+            workers.emplace_back(&downloader_t::http_worker, &hibpdl, i);
+        }
+        bool write_failed = false;
+        bool incomplete = false;
+        // where the output ends once the writer is done
+        std::size_t written_prefix = first_hash_prefix;
+        while (hibpdl.next_batch())
         {
-            workers.emplace_back(&hibp::downloader::http_worker, &hibpdl);
+            auto const [hash_prefix, next_hash_prefix] = hibpdl.batch_range();
+            if (hibpdl.batch_failed_count() > 0)
+            {
+                // Writing the batch would leave a gap in the output that the
+                // checkpoint skips. Stop here instead, so that a rerun
+                // continues from this batch.
+                std::cerr << "\u001b[31;1mERROR: batch ["
+                          << std::hex << std::setw(4) << std::setfill('0')
+                          << hash_prefix << "0h, "
+                          << std::hex << std::setw(4) << std::setfill('0')
+                          << (next_hash_prefix - 1) << "fh] is incomplete; stopping before it.\u001b[0m"
+                          << std::endl;
+                incomplete = true;
+                hibpdl.stop();
+                break;
+            }
+            if (verbosity > 0)
+            {
+                std::cout << "\n"
+                          << "Batch ["
+                          << std::hex << std::setw(4) << std::setfill('0')
+                          << hash_prefix << "0h, "
+                          << std::hex << std::setw(4) << std::setfill('0')
+                          << (next_hash_prefix - 1) << "fh] complete.\n"
+                          << "Total time: "
+                          << std::dec << chrono::duration_cast<chrono::milliseconds>(t.elapsed()).count() << " ms"
+                          << std::endl;
+                std::cout << "Collecting " << hibpdl.batch_hash_count() << " entries ..." << std::endl;
+            }
+            auto const &collection = hibpdl.finalize();
+            total_hash_count += collection.size();
+            if (verbosity > 0)
+            {
+                std::cout << "Total time: "
+                          << std::dec << chrono::duration_cast<chrono::milliseconds>(t.elapsed()).count() << " ms"
+                          << std::endl;
+                // formatted aside so that `std::fixed` doesn't stick to `std::cout`
+                std::ostringstream cpu_time;
+                cpu_time << std::fixed << std::setprecision(1)
+                         << 1e9 * static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC / static_cast<double>(std::max<std::size_t>(1, total_hash_count));
+                std::cout << "CPU time per hash: " << cpu_time.str() << " ns" << std::endl;
+                std::cout << "\u001b[33;1mQueueing " << hibpdl.collection().size() << " entries for " << output_filename << " and checkpoint file " << checkpoint_filename << " ...\u001b[0m" << std::endl;
+            }
+            try
+            {
+                writer->push(hibpdl.take_collection(), hash_prefix, next_hash_prefix);
+                written_prefix = next_hash_prefix;
+            }
+            catch (std::exception const &e)
+            {
+                std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
+                write_failed = true;
+                hibpdl.stop();
+                break;
+            }
+            if (verbosity > 0)
+            {
+                std::cout << "Total time: "
+                          << std::dec << chrono::duration_cast<chrono::seconds>(t.elapsed()).count() << " s"
+                          << std::endl;
+            }
+        }
+        if (do_quit && verbosity > 1)
+        {
+            std::cout << "Main thread about to exit ..." << std::endl;
         }
         for (auto &worker : workers)
         {
             worker.join();
         }
-        if (do_quit)
+        watcher.finish();
+        try
         {
-            if (verbosity > 1)
+            writer->close();
+        }
+        catch (std::exception const &e)
+        {
+            if (!write_failed)
             {
-                std::cout << "Main thread about to exit ..." << std::endl;
+                std::cerr << "\u001b[31;1mERROR: " << e.what() << "\u001b[0m" << std::endl;
             }
-            break;
+            write_failed = true;
         }
         if (verbosity > 0)
         {
             std::cout << "\n"
-                      << "Total time: "
-                      << std::dec << chrono::duration_cast<chrono::milliseconds>(t.elapsed()).count() << " ms"
-                      << std::endl;
-            std::cout << "Sorting " << hibpdl.collection().size() << " entries ..." << std::endl;
+                      << hibpdl.stats()
+                      << "Bytes written:         " << std::dec << writer->bytes_written()
+                      << " in " << writer->write_ns() / 1'000'000 << " ms; waited "
+                      << writer->stall_ns() / 1'000'000 << " ms for the writer\n"
+                      << std::flush;
+        }
+        if (write_failed)
+        {
+            fs::remove(lock_filename);
+            return EXIT_FAILURE;
         }
-        hibp::collection_t const &collection = hibpdl.finalize();
+
         if (verbosity > 0)
         {
-            std::cout << "Total time: "
-                      << std::dec << chrono::duration_cast<chrono::milliseconds>(t.elapsed()).count() << " ms"
-                      << std::endl;
-            std::cout << "\u001b[33;1mWriting " << hibpdl.collection().size() << " entries to " << output_filename << " ...\u001b[0m" << std::endl;
+            std::cout << "Writing ETags to " << validators_filename << " ..." << std::endl;
         }
-        std::ofstream out(output_filename, std::ios::binary | std::ios::app);
-        for (auto const &item : collection)
+        // The workers may have run ahead of the writer, but a later refresh
+        // mustn't take ranges the output doesn't contain for unchanged.
+        hibpdl.validators().forget(written_prefix * downloader_t::RangesPerPrefix, hibp::etag_store::RangeCount);
+        bool const validators_saved = hibpdl.validators().save(validators_filename);
+        if (!validators_saved)
         {
-            item.dump(out);
+            std::cerr << "\u001b[31;1mERROR: cannot write " << validators_filename
+                      << "; a later `--refresh-from` can't use this output.\u001b[0m" << std::endl;
         }
-        out.close();
-        if (verbosity > 0)
+
+        std::vector<std::size_t> const failed_ranges = hibpdl.failed_ranges();
+        if (!failed_ranges.empty())
         {
-            std::cout << "\u001b[33;1mWriting checkpoint file " << checkpoint_filename << " ...\u001b[0m" << std::endl;
-        }
-        std::ofstream checkpoint(checkpoint_filename, std::ios::trunc);
-        checkpoint
-            << std::hex
-            << std::setw(4) << std::setfill('0')
-            << hash_prefix
-            << '-'
-            << std::setw(4) << std::setfill('0')
-            << (hash_prefix + hash_prefix_step)
-            << '\n'
-            << output_filename.generic_string();
-        checkpoint.close();
-        if (verbosity > 0)
+            std::cerr << "\u001b[31;1mERROR: " << std::dec << failed_ranges.size()
+                      << " range(s) could not be downloaded:";
+            std::ofstream failed(failed_filename, std::ios::trunc);
+            for (std::size_t range : failed_ranges)
+            {
+                std::cerr << ' ' << std::hex << std::setw(5) << std::setfill('0') << range;
+                failed << std::hex << std::setw(5) << std::setfill('0') << range << '\n';
+            }
+            std::cerr << "\u001b[0m\n"
+                      << "The list has been written to " << failed_filename << ".\n";
+            if (incomplete)
+            {
+                std::cerr << "The output ends before them, at prefix "
+                          << std::hex << std::setw(4) << std::setfill('0') << written_prefix
+                          << ". Run " << PROJECT_NAME << " again to continue from there.\n";
+            }
+        }
+        else if (fs::exists(failed_filename))
         {
-            std::cout << "Total time: "
-                      << std::dec << chrono::duration_cast<chrono::seconds>(t.elapsed()).count() << " s"
-                      << std::endl;
+            fs::remove(failed_filename);
         }
-    }
 
-    if (!do_quit)
-    {
-        if (verbosity > 1)
+        if (!do_quit && !incomplete)
         {
-            std::cout << "Removing checkpoint file ... \n";
+            if (verbosity > 1)
+            {
+                std::cout << "Removing checkpoint file ... \n";
+            }
+            fs::remove(checkpoint_filename);
         }
-        fs::remove(checkpoint_filename);
+        fs::remove(lock_filename);
+        return failed_ranges.empty() && validators_saved ? EXIT_SUCCESS : EXIT_FAILURE;
+    };
+    if (mode == "ntlm")
+    {
+        hibp::ntlm_downloader hibpdl{first_hash_prefix, last_hash_prefix, hash_prefix_step, num_threads};
+        return download(hibpdl);
     }
-    fs::remove(lock_filename);
-    return EXIT_SUCCESS;
+    hibp::downloader hibpdl{first_hash_prefix, last_hash_prefix, hash_prefix_step, num_threads};
+    return download(hibpdl);
 }
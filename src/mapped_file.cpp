@@ -0,0 +1,153 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "mapped_file.hpp"
+
+namespace hibp
+{
+    mapped_file::mapped_file(std::filesystem::path const &filename, access_pattern pattern)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int const fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("cannot open " + filename.string() + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd, &st) < 0)
+        {
+            int const err = errno;
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + filename.string() + ": " + std::strerror(err));
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0)
+        {
+            void *const p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                int const err = errno;
+                ::close(fd);
+                throw std::runtime_error("cannot map " + filename.string() + ": " + std::strerror(err));
+            }
+            data_ = static_cast<std::uint8_t const *>(p);
+        }
+        // the mapping keeps the file open
+        ::close(fd);
+#elif defined(_WIN32)
+        HANDLE const file = ::CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("cannot open " + filename.string());
+        }
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(file, &size))
+        {
+            ::CloseHandle(file);
+            throw std::runtime_error("cannot get the size of " + filename.string());
+        }
+        size_ = static_cast<std::size_t>(size.QuadPart);
+        if (size_ > 0)
+        {
+            // empty files can't be mapped
+            HANDLE const mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            void *const p = mapping != nullptr ? ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+            if (mapping != nullptr)
+            {
+                ::CloseHandle(mapping);
+            }
+            if (p == nullptr)
+            {
+                ::CloseHandle(file);
+                throw std::runtime_error("cannot map " + filename.string());
+            }
+            data_ = static_cast<std::uint8_t const *>(p);
+        }
+        ::CloseHandle(file);
+#else
+#error "no way to map files on this platform"
+#endif
+        advise(pattern);
+    }
+
+    mapped_file::mapped_file(mapped_file &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    mapped_file &mapped_file::operator=(mapped_file &&other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    mapped_file::~mapped_file()
+    {
+        unmap();
+    }
+
+    void mapped_file::advise(access_pattern pattern)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (data_ == nullptr)
+        {
+            return;
+        }
+        int advice = MADV_NORMAL;
+        switch (pattern)
+        {
+        case access_pattern::sequential:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case access_pattern::random:
+            advice = MADV_RANDOM;
+            break;
+        default:
+            break;
+        }
+        ::madvise(const_cast<std::uint8_t *>(data_), size_, advice);
+#else
+        (void)pattern;
+#endif
+    }
+
+    void mapped_file::unmap()
+    {
+        if (data_ == nullptr)
+        {
+            return;
+        }
+#if defined(__unix__) || defined(__APPLE__)
+        ::munmap(const_cast<std::uint8_t *>(data_), size_);
+#elif defined(_WIN32)
+        ::UnmapViewOfFile(data_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __MAPPED_FILE_HPP__
+#define __MAPPED_FILE_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+
+namespace hibp
+{
+    /**
+     * How a mapped file is going to be read, passed on to the OS as a
+     * hint for read-ahead.
+     */
+    enum class access_pattern
+    {
+        normal,
+        /** front to back, e.g. for merging and exporting */
+        sequential,
+        /** a few records here and there, e.g. for binary searches */
+        random
+    };
+
+    /**
+     * A whole file mapped read-only into memory.
+     *
+     * The file mustn't be truncated while it's mapped: touching a page
+     * past its end is fatal (SIGBUS) on POSIX systems.
+     */
+    class mapped_file final
+    {
+    public:
+        /**
+         * Map `filename`.
+         * @throws std::runtime_error if it can't be opened or mapped
+         */
+        explicit mapped_file(std::filesystem::path const &filename, access_pattern pattern = access_pattern::sequential);
+        mapped_file(mapped_file const &) = delete;
+        mapped_file &operator=(mapped_file const &) = delete;
+        mapped_file(mapped_file &&other) noexcept;
+        mapped_file &operator=(mapped_file &&other) noexcept;
+        ~mapped_file();
+
+        /**
+         * Tell the OS how the file is going to be read from now on.
+         * Only a hint; ignored where there's no way to pass it on.
+         */
+        void advise(access_pattern pattern);
+
+        inline std::uint8_t const *data() const
+        {
+            return data_;
+        }
+
+        inline std::size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        std::uint8_t const *data_{nullptr};
+        std::size_t size_{0};
+
+        void unmap();
+    };
+}
+
+#endif // __MAPPED_FILE_HPP__
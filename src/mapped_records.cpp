@@ -0,0 +1,25 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <stdexcept>
+#include <string>
+
+#include "mapped_records.hpp"
+
+namespace hibp
+{
+    template <std::size_t DigestSize>
+    basic_mapped_records<DigestSize>::basic_mapped_records(std::filesystem::path const &filename, access_pattern pattern)
+        : file_(filename, pattern)
+    {
+        if (file_.size() % RecordSize != 0)
+        {
+            throw std::runtime_error("size of " + filename.string() + " isn't a multiple of " + std::to_string(RecordSize));
+        }
+    }
+
+    template class basic_mapped_records<Sha1Size>;
+    template class basic_mapped_records<NtlmSize>;
+}
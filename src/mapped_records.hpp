@@ -0,0 +1,227 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __MAPPED_RECORDS_HPP__
+#define __MAPPED_RECORDS_HPP__
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <span>
+
+#include "hash_count.hpp"
+#include "mapped_file.hpp"
+
+namespace hibp
+{
+    /**
+     * A record in the format of `basic_hash_count::dump()` where it lies
+     * in memory, without copying it.
+     */
+    template <std::size_t DigestSize>
+    class basic_record_ref final
+    {
+    public:
+        static constexpr std::size_t RecordSize = DigestSize + sizeof(std::uint32_t);
+
+        explicit basic_record_ref(std::uint8_t const *p)
+            : p_(p)
+        {
+        }
+
+        inline std::span<std::uint8_t const, DigestSize> digest() const
+        {
+            return std::span<std::uint8_t const, DigestSize>(p_, DigestSize);
+        }
+
+        inline std::uint32_t count() const
+        {
+            return static_cast<std::uint32_t>(p_[DigestSize]) << 24 |
+                   static_cast<std::uint32_t>(p_[DigestSize + 1]) << 16 |
+                   static_cast<std::uint32_t>(p_[DigestSize + 2]) << 8 |
+                   static_cast<std::uint32_t>(p_[DigestSize + 3]);
+        }
+
+        /** the `RecordSize` bytes of the record */
+        inline std::uint8_t const *data() const
+        {
+            return p_;
+        }
+
+        inline basic_hash_count<DigestSize> to_hash_count() const
+        {
+            basic_hash_count<DigestSize> h;
+            std::memcpy(h.data.data(), p_, DigestSize);
+            h.count = count();
+            return h;
+        }
+
+        /** orders by digest, like `smallest_hash_first` */
+        inline bool operator<(basic_record_ref const &rhs) const
+        {
+            return std::memcmp(p_, rhs.p_, DigestSize) < 0;
+        }
+
+    private:
+        std::uint8_t const *p_;
+    };
+
+    /**
+     * Read-only view of a file of records as written by
+     * `basic_hash_count::dump()`, mapped into memory as a whole, so that
+     * records are read where they lie in the page cache instead of being
+     * copied into buffers first. The records form a random-access range,
+     * which suits sequential scans as well as binary searches in sorted
+     * files; `advise()` tells the OS which of the two to prepare for.
+     */
+    template <std::size_t DigestSize>
+    class basic_mapped_records final
+    {
+    public:
+        typedef basic_record_ref<DigestSize> value_type;
+
+        static constexpr std::size_t RecordSize = value_type::RecordSize;
+
+        class iterator final
+        {
+        public:
+            typedef std::random_access_iterator_tag iterator_category;
+            typedef basic_record_ref<DigestSize> value_type;
+            typedef basic_record_ref<DigestSize> reference;
+            typedef std::ptrdiff_t difference_type;
+            typedef void pointer;
+
+            iterator() = default;
+            explicit iterator(std::uint8_t const *p)
+                : p_(p)
+            {
+            }
+
+            inline reference operator*() const
+            {
+                return reference(p_);
+            }
+            inline reference operator[](difference_type n) const
+            {
+                return reference(p_ + n * static_cast<difference_type>(RecordSize));
+            }
+            inline iterator &operator++()
+            {
+                p_ += RecordSize;
+                return *this;
+            }
+            inline iterator operator++(int)
+            {
+                iterator const it = *this;
+                p_ += RecordSize;
+                return it;
+            }
+            inline iterator &operator--()
+            {
+                p_ -= RecordSize;
+                return *this;
+            }
+            inline iterator operator--(int)
+            {
+                iterator const it = *this;
+                p_ -= RecordSize;
+                return it;
+            }
+            inline iterator &operator+=(difference_type n)
+            {
+                p_ += n * static_cast<difference_type>(RecordSize);
+                return *this;
+            }
+            inline iterator &operator-=(difference_type n)
+            {
+                p_ -= n * static_cast<difference_type>(RecordSize);
+                return *this;
+            }
+            inline friend iterator operator+(iterator it, difference_type n)
+            {
+                return it += n;
+            }
+            inline friend iterator operator+(difference_type n, iterator it)
+            {
+                return it += n;
+            }
+            inline friend iterator operator-(iterator it, difference_type n)
+            {
+                return it -= n;
+            }
+            inline friend difference_type operator-(iterator const &a, iterator const &b)
+            {
+                return (a.p_ - b.p_) / static_cast<difference_type>(RecordSize);
+            }
+            auto operator<=>(iterator const &) const = default;
+
+        private:
+            std::uint8_t const *p_{nullptr};
+        };
+
+        typedef iterator const_iterator;
+
+        /**
+         * Map `filename`.
+         * @throws std::runtime_error if it can't be opened or mapped, or
+         *         its size isn't a multiple of `RecordSize`
+         */
+        explicit basic_mapped_records(std::filesystem::path const &filename, access_pattern pattern = access_pattern::sequential);
+
+        /** see `mapped_file::advise()` */
+        inline void advise(access_pattern pattern)
+        {
+            file_.advise(pattern);
+        }
+
+        inline std::size_t size() const
+        {
+            return file_.size() / RecordSize;
+        }
+
+        inline bool empty() const
+        {
+            return file_.size() == 0;
+        }
+
+        /** the bytes of all records */
+        inline std::uint8_t const *data() const
+        {
+            return file_.data();
+        }
+
+        inline std::size_t size_bytes() const
+        {
+            return file_.size();
+        }
+
+        inline value_type operator[](std::size_t i) const
+        {
+            return value_type(file_.data() + i * RecordSize);
+        }
+
+        inline iterator begin() const
+        {
+            return iterator(file_.data());
+        }
+
+        inline iterator end() const
+        {
+            return iterator(file_.data() + file_.size());
+        }
+
+    private:
+        mapped_file file_;
+    };
+
+    typedef basic_mapped_records<Sha1Size> mapped_records;
+    typedef basic_mapped_records<NtlmSize> ntlm_mapped_records;
+}
+
+#endif // __MAPPED_RECORDS_HPP__
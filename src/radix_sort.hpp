@@ -0,0 +1,188 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __RADIX_SORT_HPP__
+#define __RADIX_SORT_HPP__
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hash_count.hpp"
+
+namespace hibp
+{
+    namespace detail
+    {
+        /** below this many records a bucket is handed to `std::sort` */
+        constexpr std::size_t RadixSortCutoff = 64;
+        /** below this many records per thread sorting isn't worth spreading over threads */
+        constexpr std::size_t MinRecordsPerThread = 1U << 16;
+
+        /**
+         * Sort [`first`, `last`), whose digests are all equal up to
+         * `byte`, in place: an American flag sort, i.e. an MSD radix sort
+         * that permutes the records into their buckets without a second
+         * buffer.
+         */
+        template <std::size_t DigestSize>
+        void flag_sort(basic_hash_count<DigestSize> *first, basic_hash_count<DigestSize> *last, std::size_t byte)
+        {
+            std::size_t const n = static_cast<std::size_t>(last - first);
+            if (byte >= DigestSize || n < 2)
+            {
+                return;
+            }
+            if (n <= RadixSortCutoff)
+            {
+                std::sort(first, last, [byte](basic_hash_count<DigestSize> const &a, basic_hash_count<DigestSize> const &b)
+                          { return std::memcmp(a.data.data() + byte, b.data.data() + byte, DigestSize - byte) < 0; });
+                return;
+            }
+            std::array<std::size_t, 256> count{};
+            for (basic_hash_count<DigestSize> const *p = first; p != last; ++p)
+            {
+                ++count[p->data[byte]];
+            }
+            std::array<std::size_t, 256> head;
+            std::array<std::size_t, 256> tail;
+            std::size_t offset = 0;
+            for (std::size_t b = 0; b < 256; ++b)
+            {
+                head[b] = offset;
+                offset += count[b];
+                tail[b] = offset;
+            }
+            for (std::size_t b = 0; b < 256; ++b)
+            {
+                while (head[b] < tail[b])
+                {
+                    // carry records to their buckets until one belongs here
+                    basic_hash_count<DigestSize> record = first[head[b]];
+                    std::size_t digit = record.data[byte];
+                    while (digit != b)
+                    {
+                        std::swap(record, first[head[digit]++]);
+                        digit = record.data[byte];
+                    }
+                    first[head[b]++] = record;
+                }
+            }
+            offset = 0;
+            for (std::size_t b = 0; b < 256; ++b)
+            {
+                flag_sort(first + offset, first + offset + count[b], byte + 1);
+                offset += count[b];
+            }
+        }
+
+        /**
+         * Call `f(i)` for i in [0, `threads`), each on a thread of its own,
+         * the calling thread included.
+         */
+        template <typename F>
+        void run_parallel(std::size_t threads, F f)
+        {
+            std::vector<std::thread> pool;
+            pool.reserve(threads - 1);
+            for (std::size_t i = 1; i < threads; ++i)
+            {
+                pool.emplace_back(f, i);
+            }
+            f(0);
+            for (std::thread &t : pool)
+            {
+                t.join();
+            }
+        }
+    }
+
+    /**
+     * Sort `hashes` in the order of `smallest_hash_first` with an MSD
+     * radix sort on up to `threads` threads.
+     *
+     * The records are first distributed by their leading byte: each
+     * thread counts the leading bytes in its share of the input, and
+     * from the combined counts scatters its records straight to their
+     * place in a second buffer the size of `hashes`. The 256 buckets are
+     * then sorted independently, largest first, by whichever thread is
+     * free, without any further buffers. Random digests like these are
+     * spread evenly over the buckets; inputs that mostly share their
+     * leading byte keep only one thread busy after the first pass.
+     *
+     * With a single thread, or too few records to share, the whole sort
+     * runs in place.
+     */
+    template <std::size_t DigestSize>
+    void radix_sort(basic_collection<DigestSize> &hashes, std::size_t threads = std::thread::hardware_concurrency())
+    {
+        using record_type = basic_hash_count<DigestSize>;
+        std::size_t const n = hashes.size();
+        threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(1, n / detail::MinRecordsPerThread));
+        if (threads == 1)
+        {
+            detail::flag_sort(hashes.data(), hashes.data() + n, 0);
+            return;
+        }
+        std::size_t const chunk = (n + threads - 1) / threads;
+        std::vector<std::array<std::size_t, 256>> offsets(threads);
+        detail::run_parallel(threads, [&](std::size_t t)
+                             {
+                                 std::array<std::size_t, 256> &count = offsets[t];
+                                 count.fill(0);
+                                 record_type const *const end = hashes.data() + std::min(n, (t + 1) * chunk);
+                                 for (record_type const *p = hashes.data() + std::min(n, t * chunk); p < end; ++p)
+                                 {
+                                     ++count[p->data[0]];
+                                 }
+                             });
+        // bucket b of thread t goes after bucket b of the threads before it
+        std::array<std::size_t, 257> bucket{};
+        std::size_t offset = 0;
+        for (std::size_t b = 0; b < 256; ++b)
+        {
+            bucket[b] = offset;
+            for (std::size_t t = 0; t < threads; ++t)
+            {
+                std::size_t const count = offsets[t][b];
+                offsets[t][b] = offset;
+                offset += count;
+            }
+        }
+        bucket[256] = offset;
+        basic_collection<DigestSize> scratch(n);
+        detail::run_parallel(threads, [&](std::size_t t)
+                             {
+                                 std::array<std::size_t, 256> &next = offsets[t];
+                                 record_type const *const end = hashes.data() + std::min(n, (t + 1) * chunk);
+                                 for (record_type const *p = hashes.data() + std::min(n, t * chunk); p < end; ++p)
+                                 {
+                                     scratch[next[p->data[0]]++] = *p;
+                                 }
+                             });
+        std::array<std::size_t, 256> order;
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&bucket](std::size_t a, std::size_t b)
+                  { return bucket[a + 1] - bucket[a] > bucket[b + 1] - bucket[b]; });
+        std::atomic<std::size_t> next_bucket{0};
+        detail::run_parallel(threads, [&](std::size_t)
+                             {
+                                 for (std::size_t i = next_bucket++; i < order.size(); i = next_bucket++)
+                                 {
+                                     std::size_t const b = order[i];
+                                     detail::flag_sort(scratch.data() + bucket[b], scratch.data() + bucket[b + 1], 1);
+                                 }
+                             });
+        hashes.swap(scratch);
+    }
+}
+
+#endif // __RADIX_SORT_HPP__
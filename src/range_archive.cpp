@@ -0,0 +1,58 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include "range_archive.hpp"
+
+namespace hibp
+{
+    template <std::size_t DigestSize>
+    basic_range_archive<DigestSize>::basic_range_archive(std::filesystem::path const &filename)
+        : records_(filename, access_pattern::random)
+    {
+    }
+
+    template <std::size_t DigestSize>
+    std::size_t basic_range_archive<DigestSize>::range_at(std::size_t index) const
+    {
+        std::uint8_t const *const head = records_[index].data();
+        return static_cast<std::size_t>(head[0]) << 12 | static_cast<std::size_t>(head[1]) << 4 | static_cast<std::size_t>(head[2]) >> 4;
+    }
+
+    template <std::size_t DigestSize>
+    std::size_t basic_range_archive<DigestSize>::lower_bound(std::size_t range) const
+    {
+        std::size_t lo = 0;
+        std::size_t hi = records_.size();
+        while (lo < hi)
+        {
+            std::size_t const mid = lo + (hi - lo) / 2;
+            if (range_at(mid) < range)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    template <std::size_t DigestSize>
+    long basic_range_archive<DigestSize>::read(std::size_t range, basic_collection<DigestSize> &out) const
+    {
+        std::size_t const first = lower_bound(range);
+        std::size_t const last = lower_bound(range + 1);
+        out.reserve(out.size() + (last - first));
+        for (std::size_t i = first; i < last; ++i)
+        {
+            out.push_back(records_[i].to_hash_count());
+        }
+        return static_cast<long>(last - first);
+    }
+
+    template class basic_range_archive<Sha1Size>;
+    template class basic_range_archive<NtlmSize>;
+}
@@ -0,0 +1,54 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __RANGE_ARCHIVE_HPP__
+#define __RANGE_ARCHIVE_HPP__
+
+#include <cstdlib>
+#include <filesystem>
+
+#include "hash_count.hpp"
+#include "mapped_records.hpp"
+
+namespace hibp
+{
+    /**
+     * Read access to the records of single ranges in the sorted output
+     * of a previous run, e.g. to reuse them after a 304 Not Modified.
+     * The file is mapped, so that concurrent lookups need no locking.
+     */
+    template <std::size_t DigestSize>
+    class basic_range_archive final
+    {
+    public:
+        /** size of a record in the output file */
+        static constexpr std::size_t RecordSize = DigestSize + sizeof(std::uint32_t);
+
+        /**
+         * @throws std::runtime_error if `filename` cannot be mapped
+         */
+        explicit basic_range_archive(std::filesystem::path const &filename);
+        basic_range_archive(basic_range_archive const &) = delete;
+        basic_range_archive(basic_range_archive &&) = delete;
+
+        /**
+         * Append all records whose hashes begin with the 5-hex-digit
+         * `range` to `out`.
+         * @return the number of records appended
+         */
+        long read(std::size_t range, basic_collection<DigestSize> &out) const;
+
+    private:
+        basic_mapped_records<DigestSize> records_;
+
+        std::size_t range_at(std::size_t index) const;
+        std::size_t lower_bound(std::size_t range) const;
+    };
+
+    typedef basic_range_archive<Sha1Size> range_archive;
+    typedef basic_range_archive<NtlmSize> ntlm_range_archive;
+}
+
+#endif // __RANGE_ARCHIVE_HPP__
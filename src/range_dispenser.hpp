@@ -0,0 +1,62 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __RANGE_DISPENSER_HPP__
+#define __RANGE_DISPENSER_HPP__
+
+#include <atomic>
+#include <cstdlib>
+
+namespace hibp
+{
+    /**
+     * Hands out the numbers in [first, last) in ascending order to
+     * any number of threads without taking a lock.
+     */
+    class range_dispenser final
+    {
+    public:
+        range_dispenser(std::size_t first, std::size_t last)
+            : first_(first), last_(last), next_(first)
+        {
+        }
+        range_dispenser(range_dispenser const &) = delete;
+        range_dispenser(range_dispenser &&) = delete;
+
+        /**
+         * Fetch the next number.
+         *
+         * @return `false` if the range is exhausted.
+         */
+        inline bool take(std::size_t &n)
+        {
+            n = next_.fetch_add(1, std::memory_order_relaxed);
+            return n < last_;
+        }
+
+        inline std::size_t first() const
+        {
+            return first_;
+        }
+
+        inline std::size_t last() const
+        {
+            return last_;
+        }
+
+        inline std::size_t remaining() const
+        {
+            std::size_t const next = next_.load(std::memory_order_relaxed);
+            return next < last_ ? last_ - next : 0;
+        }
+
+    private:
+        std::size_t const first_;
+        std::size_t const last_;
+        std::atomic<std::size_t> next_;
+    };
+}
+
+#endif // __RANGE_DISPENSER_HPP__
@@ -0,0 +1,93 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "range_generator.hpp"
+#include "util.hpp"
+
+namespace hibp
+{
+    namespace
+    {
+        // the five hex digits of the range aren't repeated in the body
+        constexpr std::size_t MaxSuffixLength = 2 * 20 - 5;
+
+        /** SplitMix64, see https://prng.di.unimi.it/splitmix64.c */
+        inline std::uint64_t splitmix64(std::uint64_t &state)
+        {
+            std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        inline std::uint64_t state_for(std::size_t range, std::uint64_t seed)
+        {
+            std::uint64_t state = seed ^ (static_cast<std::uint64_t>(range) * 0xd1b54a32d192ed03ULL);
+            splitmix64(state);
+            return state;
+        }
+    }
+
+    range_generator::range_generator(std::size_t mean_records, std::uint64_t seed)
+        : mean_records_(mean_records), seed_(seed)
+    {
+    }
+
+    std::size_t range_generator::record_count(std::size_t range) const
+    {
+        if (mean_records_ < 2)
+        {
+            return mean_records_;
+        }
+        std::uint64_t state = state_for(range, ~seed_);
+        return mean_records_ / 2 + static_cast<std::size_t>(splitmix64(state) % (mean_records_ + 1));
+    }
+
+    std::string range_generator::operator()(std::size_t range, std::size_t digest_size) const
+    {
+        using suffix_t = std::array<char, MaxSuffixLength>;
+        std::size_t const suffix_length = std::min(2 * digest_size - 5, MaxSuffixLength);
+        std::uint64_t state = state_for(range, seed_ ^ digest_size);
+        std::size_t const n = record_count(range);
+        std::vector<suffix_t> suffixes(n);
+        for (suffix_t &suffix : suffixes)
+        {
+            suffix.fill('\0');
+            std::uint64_t bits = 0;
+            for (std::size_t i = 0; i < suffix_length; ++i)
+            {
+                if (i % 16 == 0)
+                {
+                    bits = splitmix64(state);
+                }
+                suffix[i] = util::nibble2hex(static_cast<std::uint8_t>(bits & 0xf));
+                bits >>= 4;
+            }
+        }
+        std::sort(suffixes.begin(), suffixes.end());
+        suffixes.erase(std::unique(suffixes.begin(), suffixes.end()), suffixes.end());
+        std::string body;
+        body.reserve(suffixes.size() * (suffix_length + 8));
+        for (suffix_t const &suffix : suffixes)
+        {
+            if (!body.empty())
+            {
+                body += "\r\n";
+            }
+            // most hashes have been seen a handful of times, very few of them
+            // millions of times
+            std::uint64_t const r = splitmix64(state);
+            std::uint64_t const count = 1 + (r >> 32) % ((r & 0xff) == 0 ? 1'000'000 : 16);
+            body.append(suffix.data(), suffix_length);
+            body += ':';
+            body += std::to_string(count);
+        }
+        return body;
+    }
+}
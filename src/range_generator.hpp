@@ -0,0 +1,47 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __RANGE_GENERATOR_HPP__
+#define __RANGE_GENERATOR_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace hibp
+{
+    /**
+     * Produces synthetic bodies for `/range/XXXXX` in the format the
+     * upstream API uses: ascending 35-digit uppercase hex suffixes,
+     * each followed by a colon and a count, lines separated by CRLF.
+     * The output only depends on the range, the mean record count and
+     * the seed, so that benchmark runs are reproducible.
+     */
+    class range_generator final
+    {
+    public:
+        static constexpr std::size_t DefaultMeanRecords = 900;
+
+        explicit range_generator(std::size_t mean_records = DefaultMeanRecords, std::uint64_t seed = 0);
+
+        /**
+         * Number of records in `range`, somewhere between half and
+         * one and a half times the mean.
+         */
+        std::size_t record_count(std::size_t range) const;
+
+        /**
+         * Body of `range` in the dataset whose digests are `digest_size`
+         * bytes long, i.e. 20 for SHA-1 or 16 for NTLM.
+         */
+        std::string operator()(std::size_t range, std::size_t digest_size = 20) const;
+
+    private:
+        std::size_t mean_records_;
+        std::uint64_t seed_;
+    };
+}
+
+#endif // __RANGE_GENERATOR_HPP__
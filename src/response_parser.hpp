@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cassert>
 #include <ctype.h>
 #include <string>
 #include <string_view>
@@ -12,7 +13,12 @@
 
 namespace hibp
 {
-    class response_parser final
+    /**
+     * Turns the body of a `/range/XXXXX` response into records with
+     * digests of `DigestSize` bytes.
+     */
+    template <std::size_t DigestSize>
+    class basic_response_parser final
     {
         static constexpr char CR = '\r';
         static constexpr char LF = '\n';
@@ -20,12 +26,14 @@ namespace hibp
         static constexpr char COLON = ':';
 
     public:
-        explicit response_parser(hash_prefix_t const &prefix)
+        typedef basic_collection<DigestSize> collection_type;
+
+        explicit basic_response_parser(hash_prefix_t const &prefix)
         {
             std::copy(prefix.begin(), prefix.end(), hex_hash_.begin());
         }
 
-        collection_t const &parse(std::string_view source)
+        collection_type const &parse(std::string_view source)
         {
             source_ = source;
             reset();
@@ -36,22 +44,22 @@ namespace hibp
             return result_;
         }
 
-        collection_t const &result() const
+        collection_type const &result() const
         {
             return result_;
         }
 
         void reset()
         {
-            result_ = collection_t{};
+            result_ = collection_type{};
             current_ = 0;
         }
 
     private:
         std::string_view source_;
-        collection_t result_;
-        hash_count hash_count_;
-        std::array<char, 40> hex_hash_;
+        collection_type result_;
+        basic_hash_count<DigestSize> hash_count_;
+        std::array<char, 2 * DigestSize> hex_hash_;
 
         std::size_t current_{0};
 
@@ -149,6 +157,9 @@ namespace hibp
             }
         }
     };
+
+    typedef basic_response_parser<Sha1Size> response_parser;
+    typedef basic_response_parser<NtlmSize> ntlm_response_parser;
 }
 
 #endif //  __RESPONSE_PARSER_HPP__
@@ -0,0 +1,58 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <algorithm>
+
+#include "retry_policy.hpp"
+#include "util.hpp"
+
+namespace hibp
+{
+    std::chrono::milliseconds retry_policy::backoff(std::size_t failures, std::mt19937 &rng) const
+    {
+        std::chrono::milliseconds::rep ceiling = base_delay.count();
+        for (std::size_t i = 1; i < failures && ceiling < max_delay.count(); ++i)
+        {
+            ceiling *= 2;
+        }
+        ceiling = std::min(ceiling, max_delay.count());
+        std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(0, ceiling);
+        return std::chrono::milliseconds(jitter(rng));
+    }
+
+    std::chrono::milliseconds retry_policy::delay(std::size_t failures, std::optional<std::chrono::milliseconds> retry_after, std::mt19937 &rng) const
+    {
+        if (retry_after.has_value())
+        {
+            return std::clamp(*retry_after, std::chrono::milliseconds::zero(), max_delay);
+        }
+        return backoff(failures, rng);
+    }
+
+    bool retry_policy::is_transient(int status)
+    {
+        return status == 408 || status == 429 || status >= 500;
+    }
+
+    std::optional<std::chrono::milliseconds> retry_policy::parse_retry_after(std::string const &value)
+    {
+        if (value.empty())
+        {
+            return std::nullopt;
+        }
+        if (value.size() < 10 && std::all_of(value.begin(), value.end(), [](char c)
+                        { return c >= '0' && c <= '9'; }))
+        {
+            return std::chrono::seconds(std::stol(value));
+        }
+        std::optional<std::time_t> const t = util::parse_http_date(value);
+        if (!t.has_value())
+        {
+            return std::nullopt;
+        }
+        auto const until = std::chrono::system_clock::from_time_t(*t) - std::chrono::system_clock::now();
+        return std::max(std::chrono::duration_cast<std::chrono::milliseconds>(until), std::chrono::milliseconds::zero());
+    }
+}
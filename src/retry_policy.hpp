@@ -0,0 +1,54 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __RETRY_POLICY_HPP__
+#define __RETRY_POLICY_HPP__
+
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+
+namespace hibp
+{
+    /**
+     * Decides whether and when a failed request is tried again.
+     */
+    struct retry_policy
+    {
+        /** attempts per range, the first one included, before the range is given up */
+        std::size_t max_attempts{8};
+        /** upper bound of the delay after the first failure */
+        std::chrono::milliseconds base_delay{250};
+        /** upper bound of any delay, including those requested via `Retry-After` */
+        std::chrono::milliseconds max_delay{60'000};
+
+        /**
+         * Exponential backoff with full jitter: a random delay between zero and
+         * `base_delay` * 2^(`failures` - 1), but not more than `max_delay`.
+         */
+        std::chrono::milliseconds backoff(std::size_t failures, std::mt19937 &rng) const;
+
+        /**
+         * Delay before the next attempt, honouring the server's `Retry-After`
+         * if it sent one.
+         */
+        std::chrono::milliseconds delay(std::size_t failures, std::optional<std::chrono::milliseconds> retry_after, std::mt19937 &rng) const;
+
+        /**
+         * Whether a request that was answered with `status` may succeed later on.
+         */
+        static bool is_transient(int status);
+
+        /**
+         * Parse the value of a `Retry-After` header, which is either a number
+         * of seconds or an HTTP date.
+         */
+        static std::optional<std::chrono::milliseconds> parse_retry_after(std::string const &value);
+    };
+}
+
+#endif // __RETRY_POLICY_HPP__
@@ -0,0 +1,490 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+#include "simd.hpp"
+#include "util.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HIBP_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HIBP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HIBP_TARGET(isa)
+#endif
+
+namespace hibp::simd
+{
+    namespace
+    {
+        bool decode_hex_scalar(char const *src, std::uint8_t *dst, std::size_t n)
+        {
+            return ::util::hex_decode({src, 2 * n}, {dst, n});
+        }
+
+        void encode_hex_scalar(std::uint8_t const *src, char *dst, std::size_t n)
+        {
+            ::util::hex_encode({src, n}, {dst, 2 * n});
+        }
+
+        std::size_t parse_count_scalar(char const *src, std::size_t available, std::uint32_t &value)
+        {
+            std::uint64_t num = 0;
+            std::size_t i = 0;
+            while (i < available && i <= MaxCountDigits && src[i] >= '0' && src[i] <= '9')
+            {
+                num = num * 10 + static_cast<std::uint64_t>(src[i] - '0');
+                ++i;
+            }
+            if (i > MaxCountDigits || num > std::numeric_limits<std::uint32_t>::max())
+            {
+                return 0;
+            }
+            value = static_cast<std::uint32_t>(num);
+            return i;
+        }
+
+        /**
+         * Parse counts of up to seven digits with a single 8-byte load,
+         * longer ones digit by digit.
+         */
+        std::size_t parse_count_swar(char const *src, std::size_t available, std::uint32_t &value)
+        {
+            if constexpr (std::endian::native != std::endian::little)
+            {
+                return parse_count_scalar(src, available, value);
+            }
+            if (available < 8)
+            {
+                return parse_count_scalar(src, available, value);
+            }
+            std::uint64_t chunk;
+            std::memcpy(&chunk, src, sizeof(chunk));
+            // digits become 0..9, anything else has a high nibble or is > 9;
+            // a carry out of a non-digit byte only affects the bytes after it
+            std::uint64_t const t = chunk ^ 0x3030303030303030ULL;
+            std::uint64_t const non_digits = (t | (t + 0x0606060606060606ULL)) & 0xf0f0f0f0f0f0f0f0ULL;
+            if (non_digits == 0)
+            {
+                return parse_count_scalar(src, available, value);
+            }
+            int const len = std::countr_zero(non_digits) / 8;
+            if (len == 0)
+            {
+                return 0;
+            }
+            // shift the digits to the top, i.e. pad with leading zeros, and
+            // combine pairs, quads and octets
+            std::uint64_t v = t << (8 * (8 - len));
+            v = v * 10 + (v >> 8);
+            v = ((v & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32)) +
+                 ((v >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32))) >>
+                32;
+            value = static_cast<std::uint32_t>(v);
+            return static_cast<std::size_t>(len);
+        }
+
+        void encode_records_scalar(std::uint8_t const *src, std::uint8_t *dst, std::size_t n, std::size_t record_size)
+        {
+            if (n == 0)
+            {
+                return;
+            }
+            std::memcpy(dst, src, n * record_size);
+            if constexpr (std::endian::native == std::endian::little)
+            {
+                std::uint8_t *count = dst + record_size - sizeof(std::uint32_t);
+                for (std::size_t i = 0; i < n; ++i, count += record_size)
+                {
+                    std::uint32_t c;
+                    std::memcpy(&c, count, sizeof(c));
+                    c = (c >> 24) | ((c >> 8) & 0xff00U) | ((c << 8) & 0xff0000U) | (c << 24);
+                    std::memcpy(count, &c, sizeof(c));
+                }
+            }
+        }
+
+#if defined(HIBP_SIMD_X86)
+        /**
+         * Nibble values of 16 hex digits and a mask of the lanes that
+         * actually hold hex digits.
+         */
+        HIBP_TARGET("sse4.1")
+        inline __m128i nibbles_sse(__m128i c, int &valid)
+        {
+            __m128i const lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+            __m128i const is_digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                                   _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+            __m128i const is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                                   _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+            valid = _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+            // '0'..'9' carry their value in the low nibble, 'A'..'F' and
+            // 'a'..'f' carry it minus 9
+            __m128i const low = _mm_and_si128(c, _mm_set1_epi8(0x0f));
+            return _mm_add_epi8(low, _mm_and_si128(is_alpha, _mm_set1_epi8(9)));
+        }
+
+        HIBP_TARGET("sse4.1")
+        bool decode_hex_sse41(char const *src, std::uint8_t *dst, std::size_t n)
+        {
+            assert(n <= 32);
+            alignas(16) std::uint8_t out[32];
+            std::size_t const digits = 2 * n;
+            for (std::size_t i = 0; i < digits; i += 16)
+            {
+                int valid;
+                __m128i const nib = nibbles_sse(_mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i)), valid);
+                int const need = digits - i >= 16 ? 0xffff : (1 << static_cast<int>(digits - i)) - 1;
+                if ((valid & need) != need)
+                {
+                    return false;
+                }
+                // hi * 16 + lo for each pair of nibbles
+                __m128i const bytes = _mm_maddubs_epi16(nib, _mm_set1_epi16(0x0110));
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i / 2), _mm_packus_epi16(bytes, bytes));
+            }
+            std::memcpy(dst, out, n);
+            return true;
+        }
+
+        HIBP_TARGET("avx2")
+        bool decode_hex_avx2(char const *src, std::uint8_t *dst, std::size_t n)
+        {
+            assert(n <= 32);
+            alignas(32) std::uint8_t out[32];
+            std::size_t const digits = 2 * n;
+            for (std::size_t i = 0; i < digits; i += 32)
+            {
+                __m256i const c = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+                __m256i const lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+                __m256i const is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+                __m256i const is_alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+                std::uint32_t const valid = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)));
+                std::uint32_t const need = digits - i >= 32 ? 0xffffffffU : (1U << (digits - i)) - 1;
+                if ((valid & need) != need)
+                {
+                    return false;
+                }
+                __m256i const nib = _mm256_add_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x0f)),
+                                                    _mm256_and_si256(is_alpha, _mm256_set1_epi8(9)));
+                __m256i const words = _mm256_maddubs_epi16(nib, _mm256_set1_epi16(0x0110));
+                // packing works per 128-bit lane, so gather the low halves of both lanes
+                __m256i const packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xd8);
+                _mm_store_si128(reinterpret_cast<__m128i *>(out + i / 2), _mm256_castsi256_si128(packed));
+            }
+            std::memcpy(dst, out, n);
+            return true;
+        }
+
+        HIBP_TARGET("sse4.1")
+        void encode_hex_sse41(std::uint8_t const *src, char *dst, std::size_t n)
+        {
+            __m128i const digits = _mm_loadu_si128(reinterpret_cast<__m128i const *>(::util::HexDigits));
+            __m128i const low_nibbles = _mm_set1_epi8(0x0f);
+            std::size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i));
+                __m128i const hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibbles));
+                __m128i const lo = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, low_nibbles));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+            }
+            encode_hex_scalar(src + i, dst + 2 * i, n - i);
+        }
+
+        HIBP_TARGET("avx2")
+        void encode_hex_avx2(std::uint8_t const *src, char *dst, std::size_t n)
+        {
+            __m256i const digits = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const *>(::util::HexDigits)));
+            __m256i const low_nibbles = _mm256_set1_epi8(0x0f);
+            std::size_t i = 0;
+            for (; i + 32 <= n; i += 32)
+            {
+                __m256i const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i));
+                __m256i const hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibbles));
+                __m256i const lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(bytes, low_nibbles));
+                // unpacking works per 128-bit lane, so put the halves back in order
+                __m256i const first = _mm256_unpacklo_epi8(hi, lo);
+                __m256i const second = _mm256_unpackhi_epi8(hi, lo);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+            }
+            encode_hex_sse41(src + i, dst + 2 * i, n - i);
+        }
+
+        /**
+         * pshufb indexes that reverse the bytes of the count at the end of
+         * each record of `RecordSize` bytes and leave all other bytes in
+         * place, for `Period` bytes of records, after which the pattern
+         * repeats. With records and counts 4-byte aligned, no count
+         * straddles two 16-byte lanes, so the indexes are relative to the
+         * lane they're in, as pshufb wants them.
+         */
+        template <std::size_t RecordSize>
+        struct count_shuffle
+        {
+            static_assert(RecordSize % sizeof(std::uint32_t) == 0);
+            static constexpr std::size_t Period = std::lcm(RecordSize, std::size_t{32});
+            alignas(32) std::array<std::uint8_t, Period> index{};
+
+            constexpr count_shuffle()
+            {
+                for (std::size_t i = 0; i < Period; ++i)
+                {
+                    std::size_t const offset = i % RecordSize;
+                    std::size_t const count = RecordSize - sizeof(std::uint32_t);
+                    std::size_t const from = offset < count
+                                                 ? i
+                                                 : i - offset + count + (RecordSize - 1 - offset);
+                    index[i] = static_cast<std::uint8_t>(from % 16);
+                }
+            }
+        };
+
+        constexpr count_shuffle<20> Shuffle20;
+        constexpr count_shuffle<24> Shuffle24;
+
+        /**
+         * Indexes for records of `record_size` bytes and the number of
+         * bytes they cover, or `nullptr` for sizes the vector kernels
+         * leave to the scalar one.
+         */
+        std::uint8_t const *count_shuffle_for(std::size_t record_size, std::size_t &period)
+        {
+            switch (record_size)
+            {
+            case 20:
+                period = Shuffle20.Period;
+                return Shuffle20.index.data();
+            case 24:
+                period = Shuffle24.Period;
+                return Shuffle24.index.data();
+            default:
+                return nullptr;
+            }
+        }
+
+        HIBP_TARGET("sse4.1")
+        void encode_records_sse41(std::uint8_t const *src, std::uint8_t *dst, std::size_t n, std::size_t record_size)
+        {
+            std::size_t period = 0;
+            std::uint8_t const *const index = count_shuffle_for(record_size, period);
+            std::size_t i = 0;
+            if constexpr (std::endian::native == std::endian::little)
+            {
+                std::size_t const bytes = n * record_size;
+                for (; index != nullptr && i + period <= bytes; i += period)
+                {
+                    for (std::size_t j = 0; j < period; j += 16)
+                    {
+                        __m128i const records = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + i + j));
+                        __m128i const shuffle = _mm_load_si128(reinterpret_cast<__m128i const *>(index + j));
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + j), _mm_shuffle_epi8(records, shuffle));
+                    }
+                }
+            }
+            encode_records_scalar(src + i, dst + i, n - i / record_size, record_size);
+        }
+
+        HIBP_TARGET("avx2")
+        void encode_records_avx2(std::uint8_t const *src, std::uint8_t *dst, std::size_t n, std::size_t record_size)
+        {
+            std::size_t period = 0;
+            std::uint8_t const *const index = count_shuffle_for(record_size, period);
+            std::size_t i = 0;
+            if constexpr (std::endian::native == std::endian::little)
+            {
+                std::size_t const bytes = n * record_size;
+                for (; index != nullptr && i + period <= bytes; i += period)
+                {
+                    for (std::size_t j = 0; j < period; j += 32)
+                    {
+                        __m256i const records = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + i + j));
+                        __m256i const shuffle = _mm256_load_si256(reinterpret_cast<__m256i const *>(index + j));
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + j), _mm256_shuffle_epi8(records, shuffle));
+                    }
+                }
+            }
+            encode_records_scalar(src + i, dst + i, n - i / record_size, record_size);
+        }
+
+        HIBP_TARGET("sse4.1")
+        std::size_t parse_count_sse41(char const *src, std::size_t available, std::uint32_t &value)
+        {
+            if (available < 16)
+            {
+                return parse_count_scalar(src, available, value);
+            }
+            __m128i const digits = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(src)), _mm_set1_epi8('0'));
+            // digits are the bytes that are <= 9 when taken as unsigned
+            int const non_digits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(digits, _mm_set1_epi8(9)), _mm_set1_epi8(9))) ^ 0xffff;
+            int const len = non_digits == 0 ? 16 : std::countr_zero(static_cast<unsigned>(non_digits));
+            if (len == 0 || len > static_cast<int>(MaxCountDigits))
+            {
+                return 0;
+            }
+            // move the digits to the end of the register and zero the rest:
+            // pshufb zeroes lanes whose index has the high bit set
+            __m128i const iota = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            __m128i const aligned = _mm_shuffle_epi8(digits, _mm_add_epi8(iota, _mm_set1_epi8(static_cast<char>(len - 16))));
+            __m128i const pairs = _mm_maddubs_epi16(aligned, _mm_set1_epi16(0x010a));
+            __m128i const quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010064));
+            __m128i const octs = _mm_madd_epi16(_mm_packus_epi32(quads, quads), _mm_set1_epi32(0x00012710));
+            std::uint64_t const num = static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm_cvtsi128_si32(octs))) * 100'000'000ULL +
+                                      static_cast<std::uint32_t>(_mm_extract_epi32(octs, 1));
+            if (num > std::numeric_limits<std::uint32_t>::max())
+            {
+                return 0;
+            }
+            value = static_cast<std::uint32_t>(num);
+            return static_cast<std::size_t>(len);
+        }
+
+        bool cpu_supports(instruction_set isa)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            switch (isa)
+            {
+            case instruction_set::avx2:
+                return __builtin_cpu_supports("avx2");
+            case instruction_set::sse41:
+                return __builtin_cpu_supports("sse4.1");
+            default:
+                return true;
+            }
+#elif defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            int const max_leaf = info[0];
+            __cpuid(info, 1);
+            bool const sse41 = (info[2] & (1 << 19)) != 0;
+            bool const os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+            switch (isa)
+            {
+            case instruction_set::avx2:
+                if (max_leaf < 7 || !os_avx)
+                {
+                    return false;
+                }
+                __cpuidex(info, 7, 0);
+                return (info[1] & (1 << 5)) != 0;
+            case instruction_set::sse41:
+                return sse41;
+            default:
+                return true;
+            }
+#else
+            return isa == instruction_set::scalar;
+#endif
+        }
+#else
+        bool cpu_supports(instruction_set isa)
+        {
+            return isa == instruction_set::scalar;
+        }
+#endif
+
+        kernels const &kernels_for(instruction_set isa)
+        {
+            static kernels const scalar{decode_hex_scalar, encode_hex_scalar, parse_count_swar, encode_records_scalar};
+#if defined(HIBP_SIMD_X86)
+            static kernels const sse41{decode_hex_sse41, encode_hex_sse41, parse_count_sse41, encode_records_sse41};
+            static kernels const avx2{decode_hex_avx2, encode_hex_avx2, parse_count_sse41, encode_records_avx2};
+            switch (isa)
+            {
+            case instruction_set::avx2:
+                return avx2;
+            case instruction_set::sse41:
+                return sse41;
+            default:
+                break;
+            }
+#else
+            (void)isa;
+#endif
+            return scalar;
+        }
+
+        instruction_set &current()
+        {
+            static instruction_set isa = detected();
+            return isa;
+        }
+    }
+
+    instruction_set detected()
+    {
+        static instruction_set const best = cpu_supports(instruction_set::avx2)
+                                                ? instruction_set::avx2
+                                            : cpu_supports(instruction_set::sse41)
+                                                ? instruction_set::sse41
+                                                : instruction_set::scalar;
+        return best;
+    }
+
+    instruction_set selected()
+    {
+        return current();
+    }
+
+    void select(instruction_set isa)
+    {
+        current() = cpu_supports(isa) ? isa : detected();
+    }
+
+    kernels const &active()
+    {
+        return kernels_for(current());
+    }
+
+    bool hex_decode(std::span<char const> src, std::span<std::uint8_t> dst)
+    {
+        assert(src.size() >= 2 * dst.size());
+        // whole blocks of 16 bytes don't make the kernels read past the digits
+        constexpr std::size_t Block = 16;
+        kernels const &k = active();
+        std::size_t i = 0;
+        bool ok = true;
+        for (; i + Block <= dst.size(); i += Block)
+        {
+            ok &= k.decode_hex(src.data() + 2 * i, dst.data() + i, Block);
+        }
+        return ::util::hex_decode(src.subspan(2 * i), dst.subspan(i)) && ok;
+    }
+
+    void hex_encode(std::span<std::uint8_t const> src, std::span<char> dst)
+    {
+        assert(dst.size() >= 2 * src.size());
+        active().encode_hex(src.data(), dst.data(), src.size());
+    }
+
+    char const *name(instruction_set isa)
+    {
+        switch (isa)
+        {
+        case instruction_set::avx2:
+            return "avx2";
+        case instruction_set::sse41:
+            return "sse4.1";
+        default:
+            return "scalar";
+        }
+    }
+}
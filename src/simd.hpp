@@ -0,0 +1,89 @@
+/*
+ * HIBPDL++ - Fast, multithreaded downloader for HaveIBeenPwned hashes
+ * Copyright (c) 2023 Oliver Lau <oliver.lau@gmail.com>
+ */
+
+#ifndef __SIMD_HPP__
+#define __SIMD_HPP__
+
+#include <cstdint>
+#include <cstdlib>
+#include <span>
+
+namespace hibp::simd
+{
+    enum class instruction_set
+    {
+        scalar,
+        sse41,
+        avx2
+    };
+
+    /**
+     * Kernels for one instruction set.
+     */
+    struct kernels
+    {
+        /**
+         * Decode the 2*`n` hex digits (either case) at `src` into `n` bytes
+         * at `dst`, with `n` <= 32. The kernels may read up to `HexPadding`
+         * bytes beyond the digits, so `src` must be padded accordingly.
+         * @return `false` if one of the characters isn't a hex digit
+         */
+        bool (*decode_hex)(char const *src, std::uint8_t *dst, std::size_t n);
+
+        /**
+         * Encode the `n` bytes at `src` as 2*`n` uppercase hex digits at `dst`.
+         */
+        void (*encode_hex)(std::uint8_t const *src, char *dst, std::size_t n);
+
+        /**
+         * Parse the decimal number at `src`, reading no more than
+         * `available` bytes.
+         * @return the number of digits consumed, or 0 if there's no
+         *         number or it has more than `MaxCountDigits` digits
+         */
+        std::size_t (*parse_count)(char const *src, std::size_t available, std::uint32_t &value);
+
+        /**
+         * Copy the `n` records of `record_size` bytes at `src` to `dst`,
+         * turning the 32-bit count at the end of each record from host
+         * into big-endian byte order.
+         */
+        void (*encode_records)(std::uint8_t const *src, std::uint8_t *dst, std::size_t n, std::size_t record_size);
+    };
+
+    constexpr std::size_t HexPadding = 32;
+    constexpr std::size_t MaxCountDigits = 10;
+
+    /**
+     * Best instruction set supported by the CPU this is running on.
+     */
+    instruction_set detected();
+
+    /**
+     * Instruction set whose kernels `active()` returns: `detected()`
+     * unless overridden with `select()`.
+     */
+    instruction_set selected();
+
+    /**
+     * Use the kernels of `isa`, or of `detected()` if the CPU doesn't
+     * support `isa`. Meant for benchmarks, not to be called while the
+     * kernels are in use.
+     */
+    void select(instruction_set isa);
+
+    kernels const &active();
+
+    /**
+     * Like `util::hex_decode()` and `util::hex_encode()` (uppercase),
+     * but with the active kernels. Neither reads beyond the spans.
+     */
+    bool hex_decode(std::span<char const> src, std::span<std::uint8_t> dst);
+    void hex_encode(std::span<std::uint8_t const> src, std::span<char> dst);
+
+    char const *name(instruction_set isa);
+}
+
+#endif // __SIMD_HPP__
@@ -4,37 +4,56 @@
  */
 
 #include <cassert>
+#include <iomanip>
+#include <locale>
 #include <utility>
 
 #include "util.hpp"
 
 namespace util
 {
-
-    char nibble2hex(std::uint8_t nibble)
+    namespace
     {
-        assert(nibble >= 0 && nibble <= 0xf);
-        return (nibble < 10)
-                   ? '0' + static_cast<char>(nibble)
-                   : 'A' + static_cast<char>(nibble) - 10;
+        /** both hex digits of every byte value, high nibble first */
+        constexpr std::array<char, 512> make_hex_pairs(char const *digits)
+        {
+            std::array<char, 512> pairs{};
+            for (std::size_t i = 0; i < 256; ++i)
+            {
+                pairs[2 * i] = digits[i >> 4];
+                pairs[2 * i + 1] = digits[i & 0xf];
+            }
+            return pairs;
+        }
+
+        constexpr std::array<char, 512> HexPairs = make_hex_pairs(HexDigits);
+        constexpr std::array<char, 512> LowerHexPairs = make_hex_pairs(LowerHexDigits);
     }
 
-    uint8_t hex2nibble(char c)
+    bool hex_decode(std::span<char const> src, std::span<std::uint8_t> dst)
     {
-        assert((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'));
-        if ((c >= '0' && c <= '9'))
+        assert(src.size() >= 2 * dst.size());
+        // collect the high bits of all values to check them only once
+        std::uint8_t invalid = 0;
+        for (std::size_t i = 0; i < dst.size(); ++i)
         {
-            return static_cast<uint8_t>(c - '0');
+            std::uint8_t const hi = HexValues[static_cast<unsigned char>(src[2 * i])];
+            std::uint8_t const lo = HexValues[static_cast<unsigned char>(src[2 * i + 1])];
+            invalid |= hi | lo;
+            dst[i] = static_cast<std::uint8_t>(hi << 4 | (lo & 0xf));
         }
-        else if ((c >= 'a' && c <= 'f'))
-        {
-            return static_cast<uint8_t>(c - 'a' + 10);
-        } 
-        else if ((c >= 'A' && c <= 'F'))
+        return (invalid & 0xf0) == 0;
+    }
+
+    void hex_encode(std::span<std::uint8_t const> src, std::span<char> dst, bool lowercase)
+    {
+        assert(dst.size() >= 2 * src.size());
+        char const *const pairs = lowercase ? LowerHexPairs.data() : HexPairs.data();
+        for (std::size_t i = 0; i < src.size(); ++i)
         {
-            return static_cast<uint8_t>(c - 'A' + 10);
+            dst[2 * i] = pairs[2 * src[i]];
+            dst[2 * i + 1] = pairs[2 * src[i] + 1];
         }
-        return 0;
     }
 
     std::vector<std::string> split(const std::string &str, char delim)
@@ -66,4 +85,34 @@ namespace util
         return pair;
     }
 
+    std::optional<std::time_t> parse_http_date(const std::string &str)
+    {
+        std::tm tm{};
+        std::istringstream is(str);
+        is.imbue(std::locale::classic());
+        is >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+        if (is.fail())
+        {
+            return std::nullopt;
+        }
+#if defined(_MSC_VER)
+        return _mkgmtime(&tm);
+#else
+        return timegm(&tm);
+#endif
+    }
+
+    std::string format_http_date(std::time_t t)
+    {
+        std::tm tm{};
+#if defined(_MSC_VER)
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        std::ostringstream os;
+        os.imbue(std::locale::classic());
+        os << std::put_time(&tm, "%a, %d %b %Y %H:%M:%S GMT");
+        return os.str();
+    }
 }
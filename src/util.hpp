@@ -5,19 +5,80 @@
 #ifndef __UTIL_CPP__
 #define __UTIL_CPP__
 
+#include <array>
+#include <cassert>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
 #include <iterator>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <string>
 #include <vector>
 
 namespace util
 {
-    char nibble2hex(std::uint8_t nibble);
-    uint8_t hex2nibble(char);
+    /** marks characters in `HexValues` that aren't hex digits */
+    constexpr std::uint8_t NotHex = 0xff;
+
+    /** value of each character as a hex digit (either case), or `NotHex` */
+    constexpr std::array<std::uint8_t, 256> HexValues = []
+    {
+        std::array<std::uint8_t, 256> values{};
+        values.fill(NotHex);
+        for (int i = 0; i < 10; ++i)
+        {
+            values['0' + i] = static_cast<std::uint8_t>(i);
+        }
+        for (int i = 0; i < 6; ++i)
+        {
+            values['A' + i] = static_cast<std::uint8_t>(10 + i);
+            values['a' + i] = static_cast<std::uint8_t>(10 + i);
+        }
+        return values;
+    }();
+
+    constexpr char HexDigits[] = "0123456789ABCDEF";
+    constexpr char LowerHexDigits[] = "0123456789abcdef";
+
+    inline char nibble2hex(std::uint8_t nibble)
+    {
+        assert(nibble <= 0xf);
+        return HexDigits[nibble & 0xf];
+    }
+
+    /**
+     * Value of the hex digit `c`, 0 if it isn't one.
+     */
+    inline std::uint8_t hex2nibble(char c)
+    {
+        std::uint8_t const value = HexValues[static_cast<unsigned char>(c)];
+        assert(value != NotHex);
+        return value != NotHex ? value : 0;
+    }
+
+    /**
+     * Decode the first 2*`dst.size()` hex digits (either case) of `src`
+     * into `dst`.
+     * @return `false` if one of them isn't a hex digit
+     */
+    bool hex_decode(std::span<char const> src, std::span<std::uint8_t> dst);
+
+    /**
+     * Encode `src` as 2*`src.size()` hex digits into `dst`.
+     */
+    void hex_encode(std::span<std::uint8_t const> src, std::span<char> dst, bool lowercase = false);
+
     std::vector<std::string> split(const std::string &str, char delim);
     std::pair<std::string, std::string> unpair(const std::string &str, char delim);
 
+    /**
+     * Parse an HTTP date like "Wed, 21 Oct 2015 07:28:00 GMT".
+     */
+    std::optional<std::time_t> parse_http_date(const std::string &str);
+    std::string format_http_date(std::time_t t);
+
     template <typename InputIteratorT, typename SeparatorT>
     std::string join(InputIteratorT input, SeparatorT separator)
     {